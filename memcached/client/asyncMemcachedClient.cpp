@@ -0,0 +1,115 @@
+#include "asyncMemcachedClient.h"
+
+#include "muduo/base/Logging.h"
+#include "muduo/net/EventLoop.h"
+
+#include <boost/bind.hpp>
+
+#include <stdexcept>
+
+AsyncMemcachedClient::AsyncMemcachedClient(muduo::net::EventLoop* loop, const muduo::net::InetAddress& serverAddr)
+    : loop(loop), client(loop, serverAddr, "AsyncMemcachedClient"), flushQueued(false) {
+        client.setConnectionCallback(boost::bind(&AsyncMemcachedClient::onConnection, this, _1));
+        client.setMessageCallback(boost::bind(&AsyncMemcachedClient::onMessage, this, _1, _2, _3));
+}
+
+void AsyncMemcachedClient::send(MemcachedRequest&& request, const Callback& cb) {
+    if(loop->isInLoopThread()) {
+        sendInLoop(request, cb);
+    }
+    else {
+        loop->queueInLoop(boost::bind(&AsyncMemcachedClient::sendInLoop, this, std::move(request), cb));
+    }
+}
+
+void AsyncMemcachedClient::sendInLoop(const MemcachedRequest& request, const Callback& cb) {
+    pending.push_back(Pending{ request.type, cb });
+    output.append(request.header);
+    if(request.type == MemcachedRequest::kStorage || request.type == MemcachedRequest::kCas) {
+        output.append(request.value);
+        output.append("\r\n", 2);
+    }
+    // 本次loop迭代中之后提交的请求一起发送
+    if(connection && !flushQueued) {
+        flushQueued = true;
+        loop->queueInLoop(boost::bind(&AsyncMemcachedClient::flush, this));
+    }
+}
+
+void AsyncMemcachedClient::flush() {
+    flushQueued = false;
+    if(connection && output.readableBytes() > 0) {
+        connection->send(&output);
+    }
+}
+
+void AsyncMemcachedClient::onConnection(const muduo::net::TcpConnectionPtr& conn) {
+    if(conn->connected()) {
+        conn->setTcpNoDelay(true);
+        connection = conn;
+        flush();
+    }
+    else {
+        connection.reset();
+        output.retrieveAll();
+        failPending("connection closed");
+    }
+}
+
+void AsyncMemcachedClient::onMessage(const muduo::net::TcpConnectionPtr& conn, muduo::net::Buffer* buf,
+        muduo::Timestamp) {
+    // 已经因为响应错误关闭的连接, 之后收到的数据都丢弃
+    if(conn != connection) {
+        buf->retrieveAll();
+        return;
+    }
+    while(!pending.empty()) {
+        MemcachedResponse response;
+        size_t n = 0;
+        try {
+            n = parseResponse(pending.front().type, buf->peek(), buf->readableBytes(), &response);
+        }
+        catch(const std::runtime_error& e) {
+            buf->retrieveAll();
+            closeBroken(conn, std::string("bad response: ") + e.what());
+            return;
+        }
+        if(n == 0) {
+            return;
+        }
+        buf->retrieve(n);
+        Callback cb;
+        cb.swap(pending.front().callback);
+        pending.pop_front();
+        if(cb) {
+            cb(response);
+        }
+    }
+    if(buf->readableBytes() > 0) {
+        buf->retrieveAll();
+        closeBroken(conn, "unexpected response");
+    }
+}
+
+// 响应无法再和请求对应起来. shutdown只关闭写端, 之后的响应仍然会到达并被当作其他请求的结果,
+// 所以强制关闭连接, 并立即让所有没有响应的请求失败
+void AsyncMemcachedClient::closeBroken(const muduo::net::TcpConnectionPtr& conn, const std::string& reason) {
+    LOG_ERROR << reason << " from " << conn->peerAddress().toIpPort();
+    connection.reset();
+    output.retrieveAll();
+    conn->forceClose();
+    failPending(reason);
+}
+
+void AsyncMemcachedClient::failPending(const std::string& reason) {
+    std::deque<Pending> failed;
+    failed.swap(pending);
+    MemcachedResponse response;
+    response.status = MemcachedResponse::kError;
+    response.value = reason;
+    for(Pending& p : failed) {
+        if(p.callback) {
+            p.callback(response);
+        }
+    }
+}
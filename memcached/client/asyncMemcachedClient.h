@@ -0,0 +1,95 @@
+#ifndef MEMCACHED_ASYNC_CLIENT_H
+#define MEMCACHED_ASYNC_CLIENT_H
+
+#include "memcachedRequest.h"
+
+#include "muduo/net/TcpClient.h"
+
+#include <deque>
+#include <functional>
+#include <string>
+
+// 运行在muduo EventLoop上的异步客户端. 所有接口都可以在任意线程调用, 回调在loop线程中执行.
+// 同一次loop迭代中提交的请求合并成一次发送, 响应按请求的顺序回调.
+// 连接建立之前提交的请求在连接建立后发送; 连接断开时还没有响应的请求以kError回调.
+// 必须在loop线程中析构
+class AsyncMemcachedClient {
+    public:
+        typedef std::function<void (const MemcachedResponse&)> Callback;
+
+        AsyncMemcachedClient(muduo::net::EventLoop* loop, const muduo::net::InetAddress& serverAddr);
+
+        AsyncMemcachedClient(const AsyncMemcachedClient&) = delete;
+
+        AsyncMemcachedClient& operator=(const AsyncMemcachedClient&) = delete;
+
+        void connect() { client.connect(); }
+
+        void disconnect() { client.disconnect(); }
+
+        void set(const std::string& key, const std::string& value, uint32_t expire, const Callback& cb) {
+            send(MemcachedRequest::storage("set", key, value, expire), cb);
+        }
+
+        void add(const std::string& key, const std::string& value, uint32_t expire, const Callback& cb) {
+            send(MemcachedRequest::storage("add", key, value, expire), cb);
+        }
+
+        void replace(const std::string& key, const std::string& value, uint32_t expire, const Callback& cb) {
+            send(MemcachedRequest::storage("replace", key, value, expire), cb);
+        }
+
+        void append(const std::string& key, const std::string& value, const Callback& cb) {
+            send(MemcachedRequest::storage("append", key, value, 0), cb);
+        }
+
+        void prepend(const std::string& key, const std::string& value, const Callback& cb) {
+            send(MemcachedRequest::storage("prepend", key, value, 0), cb);
+        }
+
+        void cas(const std::string& key, const std::string& value, int64_t casUnique, uint32_t expire,
+                const Callback& cb) {
+            send(MemcachedRequest::cas(key, value, casUnique, expire), cb);
+        }
+
+        void get(const std::string& key, const Callback& cb) { send(MemcachedRequest::get(key, false), cb); }
+
+        void gets(const std::string& key, const Callback& cb) { send(MemcachedRequest::get(key, true), cb); }
+
+        void deleteKey(const std::string& key, const Callback& cb) { send(MemcachedRequest::deleteKey(key), cb); }
+
+        void incr(const std::string& key, uint64_t value, const Callback& cb) {
+            send(MemcachedRequest::arithmetic("incr", key, value), cb);
+        }
+
+        void decr(const std::string& key, uint64_t value, const Callback& cb) {
+            send(MemcachedRequest::arithmetic("decr", key, value), cb);
+        }
+
+        void touch(const std::string& key, uint32_t expire, const Callback& cb) {
+            send(MemcachedRequest::touch(key, expire), cb);
+        }
+
+    private:
+        struct Pending {
+            MemcachedRequest::Type type;
+            Callback callback;
+        };
+
+        void send(MemcachedRequest&& request, const Callback& cb);
+        void sendInLoop(const MemcachedRequest& request, const Callback& cb);
+        void flush();
+        void onConnection(const muduo::net::TcpConnectionPtr& conn);
+        void onMessage(const muduo::net::TcpConnectionPtr& conn, muduo::net::Buffer* buf, muduo::Timestamp);
+        void closeBroken(const muduo::net::TcpConnectionPtr& conn, const std::string& reason);
+        void failPending(const std::string& reason);
+
+        muduo::net::EventLoop* loop;
+        muduo::net::TcpClient client;
+        muduo::net::TcpConnectionPtr connection; // 只在loop线程中访问
+        muduo::net::Buffer output; // 还没有交给连接的请求
+        bool flushQueued;
+        std::deque<Pending> pending; // 已提交还没有响应的请求, 按提交顺序
+};
+
+#endif
@@ -6,7 +6,45 @@
 #include <thread>
 #include <chrono>
 
+#include "asyncMemcachedClient.h"
 #include "memcachedClient.h"
+#include "memcachedCluster.h"
+#include "memcachedPool.h"
+
+#include "muduo/base/CountDownLatch.h"
+#include "muduo/net/EventLoop.h"
+#include "muduo/net/EventLoopThread.h"
+#include "muduo/net/InetAddress.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <set>
+
+namespace {
+
+// 在本机的port上监听, 用来模拟服务器
+int listenOn(uint16_t port) {
+    int listenfd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    ::setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(::bind(listenfd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listenfd, 16) != 0) {
+        ::close(listenfd);
+        return -1;
+    }
+
+    return listenfd;
+}
+
+}
 
 struct MemcachedClientStart{
     MemcachedClientStart() :client("127.0.0.1", 11211) { client.connect(); };
@@ -203,5 +241,444 @@ BOOST_AUTO_TEST_CASE(getsMulti) {
     BOOST_REQUIRE_EQUAL(values2["key3"].first, "value3");
 }
 
+BOOST_AUTO_TEST_CASE(largeValue) {
+    // 大于接收缓冲区的初始大小, value中间包含\r\n
+    std::string value(100 * 1024, 'v');
+    value[50 * 1024] = '\r';
+    value[50 * 1024 + 1] = '\n';
+    client.set("key1", value);
+    client.set("key2", "value2");
+    BOOST_REQUIRE_EQUAL(client.get("key1"), value);
+
+    std::vector<std::string> keys{"key1", "key2"};
+    auto values = client.getMulti(keys);
+    BOOST_REQUIRE_EQUAL(values.size(), 2);
+    BOOST_REQUIRE_EQUAL(values["key1"], value);
+    BOOST_REQUIRE_EQUAL(values["key2"], "value2");
+}
+
+BOOST_AUTO_TEST_CASE(tooLargeValue) {
+    client.set("key1", "old");
+    client.set("key2", "value2");
+    // 刚超过最大item, 数据块中的内容不能被当作命令执行
+    std::string value(1024 * 1024 + 1, 'x');
+    std::string commands = "\r\nflush_all\r\ndelete key2\r\n";
+    value.replace(value.size() / 2, commands.size(), commands);
+    BOOST_REQUIRE_THROW(client.set("key1", value), std::runtime_error);
+
+    // 连接仍然可用, set失败时删除了旧值
+    BOOST_REQUIRE_EQUAL(client.get("key2"), "value2");
+    BOOST_REQUIRE_THROW(client.get("key1"), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(batch) {
+    client.deleteKey("key1");
+    MemcachedBatch batch;
+    for(int i = 0; i < 2000; ++i) {
+        batch.set("batch" + std::to_string(i), std::to_string(i));
+    }
+    for(int i = 0; i < 2000; ++i) {
+        batch.get("batch" + std::to_string(i));
+    }
+    batch.get("key1");
+    batch.incr("batch10", 5);
+    batch.deleteKey("batch0");
+    batch.deleteKey("batch0");
+
+    std::vector<MemcachedResponse> responses = client.execute(batch);
+    BOOST_REQUIRE_EQUAL(responses.size(), batch.size());
+    for(int i = 0; i < 2000; ++i) {
+        BOOST_REQUIRE_EQUAL(responses[i].status, MemcachedResponse::kSuccess);
+        BOOST_REQUIRE_EQUAL(responses[2000 + i].value, std::to_string(i));
+    }
+    BOOST_REQUIRE_EQUAL(responses[4000].status, MemcachedResponse::kFailure);
+    BOOST_REQUIRE_EQUAL(responses[4001].number, 15);
+    BOOST_REQUIRE_EQUAL(responses[4002].status, MemcachedResponse::kSuccess);
+    BOOST_REQUIRE_EQUAL(responses[4003].status, MemcachedResponse::kFailure);
+    BOOST_REQUIRE_EQUAL(client.get("batch20"), "20");
+}
+
+BOOST_AUTO_TEST_CASE(zeroCopy) {
+    std::string part1(60 * 1024, 'a');
+    std::string part2(40 * 1024, 'b');
+    struct iovec value[2] = { { &part1[0], part1.size() }, { &part2[0], part2.size() } };
+    BOOST_REQUIRE_EQUAL(client.set("key1", value, 2), true);
+
+    std::vector<char> buffer(128 * 1024);
+    size_t length = 0;
+    BOOST_REQUIRE_EQUAL(client.get("key1", buffer.data(), buffer.size(), &length), true);
+    BOOST_REQUIRE_EQUAL(std::string(buffer.data(), length), part1 + part2);
+
+    // buffer不够大时抛出异常, 连接仍然可用
+    BOOST_REQUIRE_THROW(client.get("key1", buffer.data(), 1024, &length), std::length_error);
+    BOOST_REQUIRE_EQUAL(length, part1.size() + part2.size());
+    client.deleteKey("key2");
+    BOOST_REQUIRE_EQUAL(client.get("key2", buffer.data(), buffer.size(), &length), false);
+}
+
+BOOST_AUTO_TEST_CASE(slowReader) {
+    // 回复远大于socket缓冲区, 客户端暂停读取时服务器保留item, 可写时继续发送
+    std::string value(512 * 1024, 'v');
+    for(size_t i = 0; i < value.size(); i += 4096) {
+        value[i] = static_cast<char>('a' + i / 4096 % 26);
+    }
+    client.set("key1", value);
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int rcvbuf = 4096;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_in addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(11211);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    BOOST_REQUIRE_EQUAL(::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)), 0);
+
+    const int kGets = 8;
+    std::string request;
+    std::string expected;
+    for(int i = 0; i < kGets; ++i) {
+        request += "get key1\r\n";
+        expected += "VALUE key1 0 " + std::to_string(value.size()) + "\r\n" + value + "\r\nEND\r\n";
+    }
+    BOOST_REQUIRE_EQUAL(::write(fd, request.data(), request.size()), static_cast<ssize_t>(request.size()));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // 慢慢读取, 回复完整且顺序正确
+    std::string response;
+    char buf[8192];
+    while(response.size() < expected.size()) {
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        BOOST_REQUIRE_GT(n, 0);
+        response.append(buf, n);
+    }
+    ::close(fd);
+    BOOST_REQUIRE(response == expected);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+// 集群的测试还需要在11212端口启动第二个服务器
+BOOST_AUTO_TEST_SUITE(MemcachedClusterSuite);
+
+BOOST_AUTO_TEST_CASE(remap) {
+    // 不连接服务器, 只检查key的分配
+    MemcachedCluster cluster;
+    for(uint16_t port = 20000; port < 20004; ++port) {
+        cluster.addServer("127.0.0.1", port);
+    }
+    const int kKeys = 20000;
+    std::vector<MemcachedClient*> before;
+    std::set<MemcachedClient*> oldClients;
+    for(int i = 0; i < kKeys; ++i) {
+        before.push_back(&cluster.clientOf("key" + std::to_string(i)));
+        oldClients.insert(before.back());
+    }
+    BOOST_REQUIRE_EQUAL(oldClients.size(), 4);
+
+    // 增加一个服务器, 大约1/5的key换到新服务器, 其余不变
+    cluster.addServer("127.0.0.1", 20004);
+    int moved = 0;
+    for(int i = 0; i < kKeys; ++i) {
+        MemcachedClient* client = &cluster.clientOf("key" + std::to_string(i));
+        if(client != before[i]) {
+            ++moved;
+            BOOST_REQUIRE(oldClients.count(client) == 0);
+        }
+    }
+    BOOST_REQUIRE_GT(moved, kKeys * 0.12);
+    BOOST_REQUIRE_LT(moved, kKeys * 0.28);
+
+    // 删除它之后回到原来的分配
+    cluster.removeServer("127.0.0.1", 20004);
+    for(int i = 0; i < kKeys; ++i) {
+        BOOST_REQUIRE(&cluster.clientOf("key" + std::to_string(i)) == before[i]);
+    }
+
+    // 删除一个原有的服务器, 只有它上面的大约1/4的key移动
+    cluster.removeServer("127.0.0.1", 20000);
+    std::set<MemcachedClient*> movedFrom;
+    moved = 0;
+    for(int i = 0; i < kKeys; ++i) {
+        if(&cluster.clientOf("key" + std::to_string(i)) != before[i]) {
+            ++moved;
+            movedFrom.insert(before[i]);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(movedFrom.size(), 1);
+    BOOST_REQUIRE_GT(moved, kKeys * 0.15);
+    BOOST_REQUIRE_LT(moved, kKeys * 0.35);
+}
+
+BOOST_AUTO_TEST_CASE(clusterGetMulti) {
+    MemcachedClient server1("127.0.0.1", 11211);
+    MemcachedClient server2("127.0.0.1", 11212);
+    server1.connect();
+    server2.connect();
+    MemcachedCluster cluster;
+    cluster.addServer("127.0.0.1", 11211);
+    cluster.addServer("127.0.0.1", 11212);
+    cluster.connect();
+
+    std::vector<std::string> keys;
+    for(int i = 0; i < 100; ++i) {
+        keys.push_back("cluster" + std::to_string(i));
+        server1.deleteKey(keys.back());
+        server2.deleteKey(keys.back());
+        BOOST_REQUIRE_EQUAL(cluster.set(keys.back(), "value" + std::to_string(i)), true);
+    }
+
+    // 每个key只保存在它所在的服务器上, 两个服务器都分到了key
+    auto values1 = server1.getMulti(keys);
+    auto values2 = server2.getMulti(keys);
+    BOOST_REQUIRE_GT(values1.size(), 0);
+    BOOST_REQUIRE_GT(values2.size(), 0);
+    BOOST_REQUIRE_EQUAL(values1.size() + values2.size(), keys.size());
+    for(auto& kv : values1) {
+        BOOST_REQUIRE_EQUAL(values2.count(kv.first), 0);
+    }
+
+    // 按服务器拆分后合并所有的结果, 不存在的key没有结果
+    keys.push_back("clusterNotExistKey");
+    server1.deleteKey(keys.back());
+    server2.deleteKey(keys.back());
+    auto values = cluster.getMulti(keys);
+    BOOST_REQUIRE_EQUAL(values.size(), 100);
+    for(int i = 0; i < 100; ++i) {
+        BOOST_REQUIRE_EQUAL(values[keys[i]], "value" + std::to_string(i));
+    }
+    auto casValues = cluster.getsMulti(keys);
+    BOOST_REQUIRE_EQUAL(casValues.size(), 100);
+    BOOST_REQUIRE_EQUAL(casValues[keys[0]].first, "value0");
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+BOOST_AUTO_TEST_SUITE(MemcachedPoolSuite);
+
+BOOST_AUTO_TEST_CASE(poolCheckoutTimeout) {
+    MemcachedPool::Options options;
+    options.maxConnections = 1;
+    options.minIdle = 0;
+    options.checkoutTimeoutMillis = 100;
+    MemcachedPool pool("127.0.0.1", 11211, options);
+
+    MemcachedPool::Lease lease = pool.checkout();
+    auto start = std::chrono::steady_clock::now();
+    BOOST_REQUIRE_THROW(pool.checkout(), std::runtime_error);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    BOOST_REQUIRE_GE(elapsed.count(), 90);
+    BOOST_REQUIRE_EQUAL(pool.down(), false);
+}
+
+BOOST_AUTO_TEST_CASE(poolLease) {
+    MemcachedPool::Options options;
+    options.maxConnections = 1;
+    options.minIdle = 0;
+    MemcachedPool pool("127.0.0.1", 11211, options);
+
+    MemcachedClient* client = nullptr;
+    {
+        MemcachedPool::Lease lease = pool.checkout();
+        client = &*lease;
+        BOOST_REQUIRE_EQUAL(lease->set("key1", "pool"), true);
+    }
+    // 归还之后取到的是同一个连接, 移动后的Lease只归还一次
+    {
+        MemcachedPool::Lease lease = pool.checkout();
+        BOOST_REQUIRE(&*lease == client);
+        MemcachedPool::Lease moved(std::move(lease));
+        BOOST_REQUIRE_EQUAL(moved->get("key1"), "pool");
+    }
+    // 另一个线程归还时等待的checkout被唤醒
+    MemcachedPool::Lease lease = pool.checkout();
+    std::thread other([&pool] {
+        MemcachedPool::Lease waited = pool.checkout();
+        BOOST_CHECK_EQUAL(waited->get("key1"), "pool");
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    { MemcachedPool::Lease returned(std::move(lease)); }
+    other.join();
+}
+
+BOOST_AUTO_TEST_CASE(poolMarkDownAndRecover) {
+    // 一开始没有服务器监听这个端口
+    const uint16_t port = 11219;
+    MemcachedPool::Options options;
+    options.minIdle = 1;
+    options.connectTimeoutMillis = 100;
+    options.healthCheckMillis = 50;
+    options.minBackoffMillis = 300;
+    MemcachedPool pool("127.0.0.1", port, options);
+
+    BOOST_REQUIRE_THROW(pool.checkout(), std::runtime_error);
+    BOOST_REQUIRE_EQUAL(pool.down(), true);
+
+    // 建立连接只需要监听, 不需要accept
+    int listenfd = listenOn(port);
+    BOOST_REQUIRE_GE(listenfd, 0);
+
+    // 退避时间内直接失败, 之后由后台线程探测恢复
+    BOOST_REQUIRE_THROW(pool.checkout(), std::runtime_error);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while(pool.down() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_REQUIRE_EQUAL(pool.down(), false);
+    {
+        MemcachedPool::Lease lease = pool.checkout();
+        BOOST_REQUIRE(lease->good());
+    }
+    ::close(listenfd);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+BOOST_AUTO_TEST_SUITE(AsyncMemcachedClientSuite);
+
+BOOST_AUTO_TEST_CASE(asyncCallbackOrder) {
+    muduo::net::EventLoopThread loopThread;
+    muduo::net::EventLoop* loop = loopThread.startLoop();
+    std::unique_ptr<AsyncMemcachedClient> client(
+            new AsyncMemcachedClient(loop, muduo::net::InetAddress("127.0.0.1", 11211)));
+    client->connect();
+
+    // 回调在loop线程中执行, 结果在latch之后检查
+    const int kRequests = 1000;
+    std::vector<int> order;
+    std::vector<MemcachedResponse> responses;
+    muduo::CountDownLatch done(1);
+    auto record = [&](int i, const MemcachedResponse& response) {
+        order.push_back(i);
+        responses.push_back(response);
+        if(i == 2 * kRequests - 1) {
+            done.countDown();
+        }
+    };
+    // 一部分请求在连接建立之前提交
+    for(int i = 0; i < kRequests; ++i) {
+        client->set("async" + std::to_string(i), std::to_string(i), 0,
+                [&record, i](const MemcachedResponse& response) { record(i, response); });
+    }
+    for(int i = 0; i < kRequests; ++i) {
+        client->get("async" + std::to_string(i),
+                [&record, i](const MemcachedResponse& response) { record(kRequests + i, response); });
+    }
+    done.wait();
+
+    BOOST_REQUIRE_EQUAL(order.size(), 2 * kRequests);
+    for(int i = 0; i < 2 * kRequests; ++i) {
+        BOOST_REQUIRE_EQUAL(order[i], i);
+        BOOST_REQUIRE_EQUAL(responses[i].status, MemcachedResponse::kSuccess);
+    }
+    for(int i = 0; i < kRequests; ++i) {
+        BOOST_REQUIRE_EQUAL(responses[kRequests + i].value, std::to_string(i));
+    }
+
+    muduo::CountDownLatch destroyed(1);
+    loop->runInLoop([&client, &destroyed] { client.reset(); destroyed.countDown(); });
+    destroyed.wait();
+}
+
+BOOST_AUTO_TEST_CASE(asyncConnectionDrop) {
+    // 服务器收到请求之后不回复直接断开
+    const uint16_t port = 11218;
+    int listenfd = listenOn(port);
+    BOOST_REQUIRE_GE(listenfd, 0);
+    std::thread server([listenfd] {
+        int connfd = ::accept(listenfd, nullptr, nullptr);
+        char buf[1024];
+        ::read(connfd, buf, sizeof(buf));
+        ::close(connfd);
+    });
+
+    muduo::net::EventLoopThread loopThread;
+    muduo::net::EventLoop* loop = loopThread.startLoop();
+    std::unique_ptr<AsyncMemcachedClient> client(
+            new AsyncMemcachedClient(loop, muduo::net::InetAddress("127.0.0.1", port)));
+
+    const int kRequests = 100;
+    std::vector<int> order;
+    std::vector<MemcachedResponse> responses;
+    muduo::CountDownLatch done(kRequests);
+    // 在一个loop回调中提交所有请求, 断开时它们都还没有响应
+    loop->runInLoop([&] {
+        for(int i = 0; i < kRequests; ++i) {
+            client->get("drop" + std::to_string(i), [&order, &responses, &done, i](const MemcachedResponse& response) {
+                order.push_back(i);
+                responses.push_back(response);
+                done.countDown();
+            });
+        }
+        client->connect();
+    });
+    done.wait();
+    server.join();
+    ::close(listenfd);
+
+    BOOST_REQUIRE_EQUAL(order.size(), kRequests);
+    for(int i = 0; i < kRequests; ++i) {
+        BOOST_REQUIRE_EQUAL(order[i], i);
+        BOOST_REQUIRE_EQUAL(responses[i].status, MemcachedResponse::kError);
+    }
+
+    muduo::CountDownLatch destroyed(1);
+    loop->runInLoop([&client, &destroyed] { client.reset(); destroyed.countDown(); });
+    destroyed.wait();
+}
+
+BOOST_AUTO_TEST_CASE(asyncMalformedReply) {
+    // 第一个响应的数据块格式错误, 之后的END不能被当作其他请求的响应
+    const uint16_t port = 11216;
+    int listenfd = listenOn(port);
+    BOOST_REQUIRE_GE(listenfd, 0);
+    std::thread server([listenfd] {
+        int connfd = ::accept(listenfd, nullptr, nullptr);
+        char buf[4096];
+        ::read(connfd, buf, sizeof(buf));
+        const char bad[] = "VALUE bad0 0 3\r\nabcXXEND\r\n";
+        ::write(connfd, bad, sizeof(bad) - 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        const char stale[] = "END\r\nEND\r\nEND\r\n";
+        ::write(connfd, stale, sizeof(stale) - 1);
+        // 等待客户端关闭
+        while(::read(connfd, buf, sizeof(buf)) > 0) {
+        }
+        ::close(connfd);
+    });
+
+    muduo::net::EventLoopThread loopThread;
+    muduo::net::EventLoop* loop = loopThread.startLoop();
+    std::unique_ptr<AsyncMemcachedClient> client(
+            new AsyncMemcachedClient(loop, muduo::net::InetAddress("127.0.0.1", port)));
+
+    const int kRequests = 10;
+    std::vector<int> order;
+    std::vector<MemcachedResponse> responses;
+    muduo::CountDownLatch done(kRequests);
+    loop->runInLoop([&] {
+        for(int i = 0; i < kRequests; ++i) {
+            client->get("bad" + std::to_string(i), [&order, &responses, &done, i](const MemcachedResponse& response) {
+                order.push_back(i);
+                responses.push_back(response);
+                done.countDown();
+            });
+        }
+        client->connect();
+    });
+    done.wait();
+    server.join();
+    ::close(listenfd);
+
+    BOOST_REQUIRE_EQUAL(order.size(), kRequests);
+    for(int i = 0; i < kRequests; ++i) {
+        BOOST_REQUIRE_EQUAL(order[i], i);
+        BOOST_REQUIRE_EQUAL(responses[i].status, MemcachedResponse::kError);
+    }
+
+    muduo::CountDownLatch destroyed(1);
+    loop->runInLoop([&client, &destroyed] { client.reset(); destroyed.countDown(); });
+    destroyed.wait();
+}
 
 BOOST_AUTO_TEST_SUITE_END();
@@ -1,6 +1,11 @@
 #include "memcachedClient.h"
 
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -8,12 +13,20 @@
 
 #include <boost/algorithm/string.hpp>
 
+#include <algorithm>
 #include <stdexcept>
 #include <sstream>
 
-void MemcachedClient::connect() {
-    fd = ::socket(AF_INET, SOCK_STREAM, 0);
-    if(fd == -1) {
+void MemcachedClient::connect(int timeoutMillis) {
+    if(fd != 0) {
+        ::close(fd);
+        fd = 0;
+    }
+    broken = false;
+    readIndex = writeIndex = 0;
+
+    int sockfd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | (timeoutMillis > 0 ? SOCK_NONBLOCK : 0), 0);
+    if(sockfd == -1) {
         throw std::runtime_error("create socket error: " + std::string(std::strerror(errno)));
     }
     
@@ -21,119 +34,359 @@ void MemcachedClient::connect() {
     serveraddr.sin_family = AF_INET;
     serveraddr.sin_port = htons(port);
     inet_aton(serverIP.c_str(), &serveraddr.sin_addr);
-    if(::connect(fd, reinterpret_cast<const struct sockaddr*>(&serveraddr), sizeof(serveraddr)) == -1) {
-        char error[64];
-        snprintf(error, 64, "connect to server %s:%d error: %s", serverIP.c_str(), port, std::strerror(errno));
+    int err = 0;
+    if(::connect(sockfd, reinterpret_cast<const struct sockaddr*>(&serveraddr), sizeof(serveraddr)) == -1) {
+        err = errno;
+    }
+    // 非阻塞connect, 等待连接完成或超时, 之后恢复为阻塞模式
+    if(err == EINPROGRESS) {
+        struct pollfd pfd = { sockfd, POLLOUT, 0 };
+        int n = ::poll(&pfd, 1, timeoutMillis);
+        socklen_t len = sizeof(err);
+        if(n == 0) {
+            err = ETIMEDOUT;
+        }
+        else if(n < 0) {
+            err = errno;
+        }
+        else if(::getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+            err = errno;
+        }
+    }
+    if(err == 0 && timeoutMillis > 0) {
+        ::fcntl(sockfd, F_SETFL, ::fcntl(sockfd, F_GETFL) & ~O_NONBLOCK);
+    }
+    if(err != 0) {
+        ::close(sockfd);
+        char error[128];
+        snprintf(error, sizeof(error), "connect to server %s:%d error: %s", serverIP.c_str(), port, std::strerror(err));
         throw std::runtime_error(error);
     }
+    fd = sockfd;
 }
 
+void MemcachedClient::setIoTimeout(int millis) {
+    struct timeval tv;
+    tv.tv_sec = millis / 1000;
+    tv.tv_usec = (millis % 1000) * 1000;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+void MemcachedClient::ping() {
+    sendRequest("version\r\n");
+    readLine();
+}
+
+void MemcachedClient::fail(const std::string& message) {
+    broken = true;
+    throw std::runtime_error(message);
+}
+
+// 连接断开时不产生SIGPIPE, 一次没有写完时继续写
 void MemcachedClient::sendRequest(const std::string data) {
-    if(::send(fd, data.c_str(), data.length(), 0) == -1) {
-        std::string err = "send " + data + std::string(std::strerror(errno));
-        throw std::runtime_error(err);
+    size_t sent = 0;
+    while(sent < data.length()) {
+        ssize_t n = ::send(fd, data.data() + sent, data.length() - sent, MSG_NOSIGNAL);
+        if(n == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fail("send " + data + std::string(std::strerror(errno)));
+        }
+        sent += n;
     }
 }
 
 bool MemcachedClient::sendRequest(const std::string& command, std::string expectResponse, std::string failReponse) {
     sendRequest(command);
-    std::string response = readLine(20);
-    if(response == expectResponse) {
-        return true;
+    return readStatus(expectResponse, failReponse);
+}
+
+void MemcachedClient::fill(size_t n) {
+    while(readableBytes() < n) {
+        // 先把未解析的数据移到开头, 空间仍然不够时再扩大
+        if(inputBuffer.size() - writeIndex < kInitialBufferSize / 2 && readIndex > 0) {
+            std::memmove(inputBuffer.data(), inputBuffer.data() + readIndex, readableBytes());
+            writeIndex -= readIndex;
+            readIndex = 0;
+        }
+        if(inputBuffer.size() < n || inputBuffer.size() - writeIndex < kInitialBufferSize / 2) {
+            inputBuffer.resize(std::max(inputBuffer.size() * 2, n));
+        }
+
+        ssize_t rn = ::read(fd, inputBuffer.data() + writeIndex, inputBuffer.size() - writeIndex);
+        if(rn == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fail(std::strerror(errno));
+        }
+        else if(rn == 0) {
+            fail("server closed");
+        }
+        writeIndex += rn;
     }
-    else if(response == failReponse) {
-        return false;
+}
+
+std::string MemcachedClient::readLine() {
+    size_t searched = 0;
+    while(true) {
+        const char* begin = inputBuffer.data() + readIndex;
+        const char* end = inputBuffer.data() + writeIndex;
+        const char* crlf = static_cast<const char*>(::memmem(begin + searched, end - begin - searched, "\r\n", 2));
+        if(crlf != nullptr) {
+            std::string line(begin, crlf);
+            retrieve(line.size() + 2);
+            return line;
+        }
+        if(readableBytes() > kMaxLineLength) {
+            fail("response line too long");
+        }
+        // \r可能是已读数据的最后一个字节
+        searched = readableBytes() > 0 ? readableBytes() - 1 : 0;
+        fill(readableBytes() + 1);
     }
-    else {
-        throw std::runtime_error(response);
+}
+
+std::string MemcachedClient::readBytes(size_t size) {
+    fill(size + 2);
+    const char* begin = inputBuffer.data() + readIndex;
+    if(begin[size] != '\r' || begin[size + 1] != '\n') {
+        fail("bad data block");
     }
+    std::string data(begin, size);
+    retrieve(size + 2);
+
+    return data;
 }
 
-std::string MemcachedClient::readLine(size_t maxlen) {
-    char* buffer = new char[maxlen+1];
-    size_t total  = 0;
-    char ch;
-    while(total < 2 || buffer[total-2] != '\r' || buffer[total-1] != '\n') {
-        ssize_t rn = ::read(fd, &ch, 1);
+void MemcachedClient::retrieve(size_t n) {
+    readIndex += n;
+    if(readIndex == writeIndex) {
+        readIndex = writeIndex = 0;
+    }
+}
+
+void MemcachedClient::readBytesInto(char* data, size_t size) {
+    size_t n = std::min(size, readableBytes());
+    std::memcpy(data, inputBuffer.data() + readIndex, n);
+    retrieve(n);
+    // 剩下的数据较多时直接读到调用者的缓冲区, 不经过inputBuffer
+    while(size - n >= kInitialBufferSize) {
+        ssize_t rn = ::read(fd, data + n, size - n);
         if(rn == -1) {
-            throw std::runtime_error(std::strerror(errno));
+            if(errno == EINTR) {
+                continue;
+            }
+            fail(std::strerror(errno));
         }
         else if(rn == 0) {
-            throw std::runtime_error("server closed");
+            fail("server closed");
         }
+        n += rn;
+    }
+    if(n < size) {
+        fill(size - n);
+        std::memcpy(data + n, inputBuffer.data() + readIndex, size - n);
+        retrieve(size - n);
+    }
+    fill(2);
+    if(inputBuffer[readIndex] != '\r' || inputBuffer[readIndex + 1] != '\n') {
+        fail("bad data block");
+    }
+    retrieve(2);
+}
 
-        buffer[total] = ch;
-        total += rn;
+void MemcachedClient::discardBytes(size_t size) {
+    size += 2;
+    const size_t chunk = kInitialBufferSize;
+    while(size > 0) {
+        fill(std::min(size, chunk));
+        size_t n = std::min(size, readableBytes());
+        retrieve(n);
+        size -= n;
     }
-    buffer[total-2] = '\0';
-    std::string response(buffer);
-    delete[] buffer;
+}
 
-    return response;
+void MemcachedClient::writeRequests(const std::vector<MemcachedRequest>& requests, size_t begin, size_t end) {
+    std::vector<struct iovec> iov;
+    iov.reserve((end - begin) * 3);
+    for(size_t i = begin; i < end; ++i) {
+        const MemcachedRequest& request = requests[i];
+        iov.push_back({ const_cast<char*>(request.header.data()), request.header.size() });
+        if(request.type == MemcachedRequest::kStorage || request.type == MemcachedRequest::kCas) {
+            iov.push_back({ const_cast<char*>(request.value.data()), request.value.size() });
+            iov.push_back({ const_cast<char*>("\r\n"), 2 });
+        }
+    }
+    sendIov(iov);
 }
 
-std::string MemcachedClient::readBytes(size_t size) {
-    size_t total = size + 2;
-    char* buffer = new char[total+1];
-    while(total > 0) {
-        ssize_t rn = ::read(fd, buffer, total);
-        if(rn == -1) {
-            throw std::runtime_error(std::strerror(errno));
+// 和writev相同, 但可以用MSG_NOSIGNAL. 会修改iov
+void MemcachedClient::sendIov(std::vector<struct iovec>& iov) {
+    size_t index = 0;
+    while(index < iov.size()) {
+        int count = static_cast<int>(std::min(iov.size() - index, static_cast<size_t>(IOV_MAX)));
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov[index];
+        msg.msg_iovlen = count;
+        ssize_t wn = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if(wn == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fail("send error: " + std::string(std::strerror(errno)));
         }
-        else if(rn == 0) {
-            throw std::runtime_error("server closed");
+        // 跳过已经写完的部分
+        size_t written = static_cast<size_t>(wn);
+        while(index < iov.size() && written >= iov[index].iov_len) {
+            written -= iov[index].iov_len;
+            ++index;
         }
+        if(written > 0) {
+            iov[index].iov_base = static_cast<char*>(iov[index].iov_base) + written;
+            iov[index].iov_len -= written;
+        }
+    }
+}
+
+void MemcachedClient::readResponse(MemcachedRequest::Type type, MemcachedResponse* response) {
+    while(true) {
+        size_t n = 0;
+        try {
+            n = parseResponse(type, inputBuffer.data() + readIndex, readableBytes(), response);
+        }
+        catch(const std::runtime_error& e) {
+            fail(e.what());
+        }
+        if(n > 0) {
+            retrieve(n);
+            return;
+        }
+        fill(readableBytes() + 1);
+    }
+}
+
+std::vector<MemcachedResponse> MemcachedClient::execute(const MemcachedBatch& batch) {
+    const std::vector<MemcachedRequest>& requests = batch.requestList();
+    std::vector<MemcachedResponse> responses(requests.size());
+    size_t begin = 0;
+    while(begin < requests.size()) {
+        size_t end = begin;
+        size_t bytes = 0;
+        while(end < requests.size() && end - begin < kPipelineRequests && bytes < kPipelineBytes) {
+            bytes += requests[end].header.size() + requests[end].value.size();
+            ++end;
+        }
+        writeRequests(requests, begin, end);
+        for(size_t i = begin; i < end; ++i) {
+            readResponse(requests[i].type, &responses[i]);
+        }
+        begin = end;
+    }
+
+    return responses;
+}
 
-        total -= rn;
+void MemcachedClient::sendStorageCommand(const char* command, const std::string& key, const struct iovec* value,
+        int count, uint32_t expire, const int64_t* casUnique) {
+    size_t valueSize = 0;
+    for(int i = 0; i < count; ++i) {
+        valueSize += value[i].iov_len;
+    }
+    char header[kMaxHeaderLength];
+    int n = casUnique == nullptr
+        ? snprintf(header, sizeof(header), "%s %s 0 %u %zu\r\n", command, key.c_str(), expire, valueSize)
+        : snprintf(header, sizeof(header), "%s %s 0 %u %zu %lld\r\n", command, key.c_str(), expire, valueSize,
+                static_cast<long long>(*casUnique));
+    if(n < 0 || static_cast<size_t>(n) >= sizeof(header)) {
+        throw std::invalid_argument("key too long: " + key);
     }
-    buffer[size] = '\0';
-    std::string response(buffer);
 
-    delete[] buffer;
+    // 命令行, value的各段和结尾的\r\n一次发送, value不复制
+    std::vector<struct iovec> iov;
+    iov.reserve(count + 2);
+    iov.push_back({ header, static_cast<size_t>(n) });
+    iov.insert(iov.end(), value, value + count);
+    iov.push_back({ const_cast<char*>("\r\n"), 2 });
+    sendIov(iov);
+}
 
-    return response;
+bool MemcachedClient::readStatus(const std::string& expectResponse, const std::string& failResponse) {
+    std::string response = readLine();
+    if(response == expectResponse) {
+        return true;
+    }
+    else if(response == failResponse) {
+        return false;
+    }
+    else {
+        throw std::runtime_error(response);
+    }
 }
 
-bool MemcachedClient::sendStorageCommand(std::string command, std::string key, std::string value,
+bool MemcachedClient::storage(const char* command, const std::string& key, const struct iovec* value, int count,
         uint32_t expire) {
-    size_t valueSize = value.length();
-    std::stringstream fmt;
-    fmt << command << " " << key << " " << 0 << " " << expire << " " << valueSize << "\r\n";
-    sendRequest(fmt.str());
+    sendStorageCommand(command, key, value, count, expire, nullptr);
+    return readStatus("STORED", "NOT_STORED");
+}
 
-    value += "\r\n";
-    return sendRequest(value, "STORED", "NOT_STORED");
+bool MemcachedClient::set(const std::string& key, const std::string& value, uint32_t expire) {
+    struct iovec iov = { const_cast<char*>(value.data()), value.size() };
+    return storage("set", key, &iov, 1, expire);
 }
 
-bool MemcachedClient::set(std::string key, std::string value, uint32_t expire) {
-    return sendStorageCommand("set", key, value, expire);
+bool MemcachedClient::add(const std::string& key, const std::string& value, uint32_t expire) {
+    struct iovec iov = { const_cast<char*>(value.data()), value.size() };
+    return storage("add", key, &iov, 1, expire);
 }
 
-bool MemcachedClient::add(std::string key, std::string value, uint32_t expire) {
-    return sendStorageCommand("add", key, value, expire);
+bool MemcachedClient::replace(const std::string& key, const std::string& value, uint32_t expire) {
+    struct iovec iov = { const_cast<char*>(value.data()), value.size() };
+    return storage("replace", key, &iov, 1, expire);
 }
 
-bool MemcachedClient::replace(std::string key, std::string value, uint32_t expire) {
-    return sendStorageCommand("replace", key, value, expire);
+bool MemcachedClient::append(const std::string& key, const std::string& value) {
+    struct iovec iov = { const_cast<char*>(value.data()), value.size() };
+    return storage("append", key, &iov, 1, 0);
 }
 
-bool MemcachedClient::append(std::string key, std::string value) {
-    return sendStorageCommand("append", key, value, 0);
+bool MemcachedClient::prepend(const std::string& key, const std::string& value) {
+    struct iovec iov = { const_cast<char*>(value.data()), value.size() };
+    return storage("prepend", key, &iov, 1, 0);
 }
 
-bool MemcachedClient::prepend(std::string key, std::string value) {
-    return sendStorageCommand("prepend", key, value, 0);
+bool MemcachedClient::cas(const std::string& key, const std::string& value, int64_t casUnique, uint32_t expire) {
+    struct iovec iov = { const_cast<char*>(value.data()), value.size() };
+    return cas(key, &iov, 1, casUnique, expire);
 }
 
-bool MemcachedClient::cas(std::string key, std::string value, int64_t casUnique, uint32_t expire) {
-    size_t valueSize = value.size();
-    std::stringstream fmt;
-    fmt << "cas " << key << " " << 0 << " " << expire << " " << valueSize << " " << casUnique << "\r\n";
-    sendRequest(fmt.str());
+bool MemcachedClient::set(const std::string& key, const struct iovec* value, int count, uint32_t expire) {
+    return storage("set", key, value, count, expire);
+}
+
+bool MemcachedClient::add(const std::string& key, const struct iovec* value, int count, uint32_t expire) {
+    return storage("add", key, value, count, expire);
+}
+
+bool MemcachedClient::replace(const std::string& key, const struct iovec* value, int count, uint32_t expire) {
+    return storage("replace", key, value, count, expire);
+}
+
+bool MemcachedClient::append(const std::string& key, const struct iovec* value, int count) {
+    return storage("append", key, value, count, 0);
+}
 
-    value += "\r\n";
-    sendRequest(value);
-    std::string response = readLine(20);
+bool MemcachedClient::prepend(const std::string& key, const struct iovec* value, int count) {
+    return storage("prepend", key, value, count, 0);
+}
+
+bool MemcachedClient::cas(const std::string& key, const struct iovec* value, int count, int64_t casUnique,
+        uint32_t expire) {
+    sendStorageCommand("cas", key, value, count, expire, &casUnique);
+    std::string response = readLine();
     if(response == "EXISTS") {
         return false;
     }
@@ -145,19 +398,73 @@ bool MemcachedClient::cas(std::string key, std::string value, int64_t casUnique,
     }
 }
 
+// VALUE <key> <flags> <bytes> [<cas unique>]. 格式错误时无法读过数据块, 连接不能再用
+void MemcachedClient::parseValueLine(const std::string& line, bool withCas, std::string* key, size_t* bytes,
+        int64_t* casUnique) {
+    std::vector<std::string> tokens;
+    boost::split(tokens, line, boost::is_any_of(" "));
+    if(tokens.size() < (withCas ? 5u : 4u)) {
+        fail("bad response: " + line);
+    }
+    try {
+        *bytes = std::stoul(tokens[3]);
+        *casUnique = withCas ? std::stoll(tokens[4]) : 0;
+    }
+    catch(const std::logic_error&) {
+        fail("bad response: " + line);
+    }
+    if(key != nullptr) {
+        key->swap(tokens[1]);
+    }
+}
+
+bool MemcachedClient::get(const std::string& key, char* buffer, size_t capacity, size_t* length,
+        int64_t* casUnique) {
+    sendRequest((casUnique == nullptr ? "get " : "gets ") + key + "\r\n");
+    std::string response = readLine();
+    if(response == "END") {
+        return false;
+    }
+    if(response.find("VALUE ") != 0) {
+        throw std::runtime_error(response);
+    }
+    size_t bytes = 0;
+    int64_t cas = 0;
+    parseValueLine(response, casUnique != nullptr, nullptr, &bytes, &cas);
+    *length = bytes;
+    bool fits = bytes <= capacity;
+    if(fits) {
+        readBytesInto(buffer, bytes);
+    }
+    else {
+        // 读完并丢弃, 保持连接上的响应和请求对应
+        discardBytes(bytes);
+    }
+    if(readLine() != "END") {
+        fail("missing END after value");
+    }
+    if(!fits) {
+        throw std::length_error("value of " + std::to_string(bytes) + " bytes is larger than the buffer");
+    }
+    if(casUnique != nullptr) {
+        *casUnique = cas;
+    }
+
+    return true;
+}
+
 std::string MemcachedClient::get(std::string key) {
     std::string command = "get " + key + "\r\n";
     sendRequest(command);
-    size_t size = 5 + key.length() + 32 + 10 + 32 + 2 + 4;
-    std::string response = readLine(size);
-    if(response.find("VALUE") == 0) {
-        std::vector<std::string> tokens;
-        boost::split(tokens, response, boost::is_any_of(" "));
-        size_t bytes = std::stoul(tokens[3]);
+    std::string response = readLine();
+    if(response.find("VALUE ") == 0) {
+        size_t bytes = 0;
+        int64_t casUnique = 0;
+        parseValueLine(response, false, nullptr, &bytes, &casUnique);
         std::string value = readBytes(bytes);
         std::string end = readBytes(3);
         if(end != "END") {
-            throw std::runtime_error(end);
+            fail(end);
         }
 
         return value;
@@ -175,27 +482,25 @@ uint64_t MemcachedClient::getLong(std::string key) {
     return std::stoull(value);
 }
 
-std::map<std::string, std::string> MemcachedClient::getMulti(std::vector<std::string>& keys)  {
-    std::string command("get");
+void MemcachedClient::sendMultiGet(const std::string& command, const std::vector<std::string>& keys) {
+    std::string request(command);
     for(auto& key : keys) {
-        command += " " + key;
+        request += " " + key;
     }
-    command += "\r\n";
-    sendRequest(command);
+    request += "\r\n";
+    sendRequest(request);
+}
 
-    std::string maxSizeKey = *std::max_element(keys.begin(), keys.end(), 
-            [](std::string& key1, std::string& key2) { return key1.length() <= key2.length(); });
-    std::map<std::string, std::string> kvs;
-    size_t size = 5 + maxSizeKey.length() + 32 + 10 + 32 + 2 + 4;
+void MemcachedClient::readValues(bool withCas, const ValueCallback& callback) {
     while(true) {
-        std::string response = readLine(size);
-        if(response.find("VALUE") == 0) {
-            std::vector<std::string> tokens;
-            boost::split(tokens, response, boost::is_any_of(" "));
-            std::string key(tokens[1]);
-            size_t size = std::stoul(tokens[3]);
-            std::string value = readBytes(size);
-            kvs[key] = value;
+        std::string response = readLine();
+        if(response.find("VALUE ") == 0) {
+            std::string key;
+            size_t bytes = 0;
+            int64_t casUnique = 0;
+            parseValueLine(response, withCas, &key, &bytes, &casUnique);
+            std::string value = readBytes(bytes);
+            callback(key, value, casUnique);
         }
         else if(response == "END") {
             break;
@@ -204,6 +509,14 @@ std::map<std::string, std::string> MemcachedClient::getMulti(std::vector<std::st
             throw std::runtime_error(response);
         }
     }
+}
+
+std::map<std::string, std::string> MemcachedClient::getMulti(std::vector<std::string>& keys)  {
+    sendMultiGet("get", keys);
+    std::map<std::string, std::string> kvs;
+    readValues(false, [&kvs](const std::string& key, std::string& value, int64_t) {
+        kvs[key].swap(value);
+    });
 
     return kvs;
 }
@@ -211,17 +524,15 @@ std::map<std::string, std::string> MemcachedClient::getMulti(std::vector<std::st
 std::pair<std::string, int64_t> MemcachedClient::gets(std::string key) {
     std::string command = "gets " + key + "\r\n";
     sendRequest(command);
-    size_t size = 5 + key.length() + 32 + 10 + 32 + 2 + 4;
-    std::string response = readLine(size);
-    if(response.find("VALUE") == 0) {
-        std::vector<std::string> tokens;
-        boost::split(tokens, response, boost::is_any_of(" "));
-        int64_t casUnique = std::stol(tokens[4]);
-        size_t bytes = std::stoul(tokens[3]);
+    std::string response = readLine();
+    if(response.find("VALUE ") == 0) {
+        size_t bytes = 0;
+        int64_t casUnique = 0;
+        parseValueLine(response, true, nullptr, &bytes, &casUnique);
         std::string value = readBytes(bytes);
         std::string end = readBytes(3);
         if(end != "END") {
-            throw std::runtime_error(end);
+            fail(end);
         }
 
         return std::make_pair(value, casUnique);
@@ -241,36 +552,13 @@ std::pair<uint64_t, int64_t> MemcachedClient::getsLong(std::string key) {
 }
 
 std::map<std::string, std::pair<std::string, int64_t>> MemcachedClient::getsMulti(std::vector<std::string>& keys) {
+    sendMultiGet("gets", keys);
     std::map<std::string, std::pair<std::string, int64_t>> kvs;
-
-    std::string command = "gets";
-    for(auto& key : keys) {
-        command += " " + key;
-    }
-    command += "\r\n";
-    sendRequest(command);
-
-    std::string maxSizeKey = *std::max_element(keys.begin(), keys.end(), 
-            [](std::string& k1, std::string& k2) { return k1.length() <= k2.length(); });
-    size_t maxlen = 5 + maxSizeKey.length() + 32 + 10 + 32 + 2 + 4;
-    while(true) {
-        std::string response = readLine(maxlen);
-        std::vector<std::string> tokens;
-        boost::split(tokens, response, boost::is_any_of(" "));
-        if(tokens[0] == "VALUE") {
-            std::string key = tokens[1];
-            size_t bytes = std::stoul(tokens[3]);
-            int64_t casUnique = std::stol(tokens[4]);
-            std::string value = readBytes(bytes);
-            kvs[key] = std::make_pair(value, casUnique);
-        }
-        else if(tokens[0] == "END") {
-            break;
-        }
-        else {
-            throw std::runtime_error(response);
-        }
-    }
+    readValues(true, [&kvs](const std::string& key, std::string& value, int64_t casUnique) {
+        std::pair<std::string, int64_t>& kv = kvs[key];
+        kv.first.swap(value);
+        kv.second = casUnique;
+    });
 
     return kvs;
 }
@@ -286,7 +574,7 @@ uint64_t MemcachedClient::incr(std::string key, uint64_t value) {
     fmt << "incr " << key << " " << value << "\r\n";
     sendRequest(fmt.str()); 
     
-    std::string response = readLine(100);
+    std::string response = readLine();
     if(response == "NOT_FOUND") {
         throw std::runtime_error("NOT_FOUND");
     }
@@ -303,7 +591,7 @@ uint64_t MemcachedClient::decr(std::string key, uint64_t value) {
     fmt << "decr " << key << " " << value << "\r\n";
     sendRequest(fmt.str());
 
-    std::string response = readLine(100);
+    std::string response = readLine();
     if(response == "NOT_FOUND") {
         throw std::runtime_error("NOT_FOUND");
     }
@@ -1,8 +1,12 @@
 #ifndef MEMCACHED_CLIENT_H
 #define MEMCACHED_CLIENT_H
 
+#include "memcachedRequest.h"
+
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <functional>
 #include <iostream>
 #include <vector>
 #include <map>
@@ -10,7 +14,8 @@
 class MemcachedClient {
     public:
         MemcachedClient(std::string serverIP, uint16_t port)
-            : serverIP(serverIP), port(port), fd(0) {}
+            : serverIP(serverIP), port(port), fd(0), broken(false),
+            inputBuffer(kInitialBufferSize), readIndex(0), writeIndex(0) {}
 
         MemcachedClient(MemcachedClient& mc) = delete;
 
@@ -22,22 +27,52 @@ class MemcachedClient {
             }
         }
 
-        void connect();
+        // timeoutMillis为0时一直等待连接完成; 已经连接时先关闭旧的连接
+        void connect(int timeoutMillis = 0);
+
+        // 读写超过millis毫秒没有进展时抛出异常, 0表示不超时
+        void setIoTimeout(int millis);
+
+        // 已连接, 没有发生网络或协议错误, 也没有未读的响应时可以继续使用
+        bool good() const { return fd != 0 && !broken && readIndex == writeIndex; }
+
+        // 发送version并读取一行响应, 不支持version的服务器返回ERROR也说明连接可用
+        void ping();
+
+        bool set(const std::string& key, const std::string& value, uint32_t expire = 0);
+
+        bool add(const std::string& key, const std::string& value, uint32_t expire = 0);
 
-        bool set(std::string key, std::string value, uint32_t expire = 0);
+        bool replace(const std::string& key, const std::string& value, uint32_t expire = 0);
 
-        bool add(std::string key, std::string value, uint32_t expire = 0);
+        bool append(const std::string& key, const std::string& value);
 
-        bool replace(std::string key, std::string value, uint32_t expire = 0);
+        bool prepend(const std::string& key, const std::string& value);
 
-        bool append(std::string key, std::string value);
+        bool cas(const std::string& key, const std::string& value, int64_t casUnique, uint32_t expire = 0);
 
-        bool prepend(std::string key, std::string value);
+        // value由count段组成, 和命令行, 结尾的\r\n一起用一次sendmsg发送, 不复制value
+        bool set(const std::string& key, const struct iovec* value, int count, uint32_t expire = 0);
 
-        bool cas(std::string key, std::string value, int64_t casUnique, uint32_t expire = 0);
+        bool add(const std::string& key, const struct iovec* value, int count, uint32_t expire = 0);
+
+        bool replace(const std::string& key, const struct iovec* value, int count, uint32_t expire = 0);
+
+        bool append(const std::string& key, const struct iovec* value, int count);
+
+        bool prepend(const std::string& key, const struct iovec* value, int count);
+
+        bool cas(const std::string& key, const struct iovec* value, int count, int64_t casUnique,
+                uint32_t expire = 0);
 
         std::string get(std::string key);
 
+        // 把value读到buffer中, 不存在时返回false. length为value的长度;
+        // value比capacity大时读完丢弃并抛出std::length_error, 这时length为需要的大小.
+        // casUnique不为nullptr时使用gets
+        bool get(const std::string& key, char* buffer, size_t capacity, size_t* length,
+                int64_t* casUnique = nullptr);
+
         uint64_t getLong(std::string key);
 
         std::map<std::string, std::string> getMulti(std::vector<std::string>& keys);
@@ -58,17 +93,66 @@ class MemcachedClient {
 
         bool touch(std::string key, uint32_t expire);
 
+        // 流水线执行batch中的请求, 返回的结果和请求一一对应.
+        // 每次用writev写出一批请求再读它们的响应, 两端的缓冲区都不会无限增长
+        std::vector<MemcachedResponse> execute(const MemcachedBatch& batch);
+
     private:
-        bool sendStorageCommand(std::string command, std::string key, std::string value, uint32_t expire = 0);
+        friend class MemcachedCluster;
+
+        // (key, value, cas unique), value可以被swap走, 不是gets时cas unique为0
+        typedef std::function<void (const std::string&, std::string&, int64_t)> ValueCallback;
+
+        // getMulti/getsMulti分为发送和接收两步, 集群客户端先向所有服务器发送再依次接收
+        void sendMultiGet(const std::string& command, const std::vector<std::string>& keys);
+        void readValues(bool withCas, const ValueCallback& callback);
+        void parseValueLine(const std::string& line, bool withCas, std::string* key, size_t* bytes,
+                int64_t* casUnique);
+
+        // casUnique不为nullptr时为cas命令
+        void sendStorageCommand(const char* command, const std::string& key, const struct iovec* value, int count,
+                uint32_t expire, const int64_t* casUnique);
+        bool storage(const char* command, const std::string& key, const struct iovec* value, int count,
+                uint32_t expire);
+        bool readStatus(const std::string& expectResponse, const std::string& failResponse);
         void sendRequest(const std::string data);
         bool sendRequest(const std::string& value, std::string expectReponse, std::string failResponse);
 
-        std::string readLine(size_t maxlen);
+        // 从接收缓冲区中取出一行, 不包括\r\n
+        std::string readLine();
+        // 取出size字节的数据和结尾的\r\n
         std::string readBytes(size_t size);
+        // 和readBytes相同, 但是读到data中, 大的value不经过接收缓冲区
+        void readBytesInto(char* data, size_t size);
+        void discardBytes(size_t size);
+        void retrieve(size_t n);
+        void sendIov(std::vector<struct iovec>& iov);
+        // 写出requests[begin, end)
+        void writeRequests(const std::vector<MemcachedRequest>& requests, size_t begin, size_t end);
+        void readResponse(MemcachedRequest::Type type, MemcachedResponse* response);
+        // 一次read尽量多读, 直到缓冲区中至少有n个字节
+        void fill(size_t n);
+        // 标记连接已损坏并抛出异常
+        [[noreturn]] void fail(const std::string& message);
+        size_t readableBytes() const { return writeIndex - readIndex; }
+
+        const static size_t kInitialBufferSize = 16 * 1024;
+        // 响应行的最大长度, 超过时认为响应出错
+        const static size_t kMaxLineLength = 4096;
+        // 存储命令的命令行, key最长250字节
+        const static size_t kMaxHeaderLength = 512;
+        // 流水线中一批请求的最大数量和字节数
+        const static size_t kPipelineRequests = 1024;
+        const static size_t kPipelineBytes = 4 * 1024 * 1024;
 
         std::string serverIP;
         uint16_t port;
         int fd;
+        bool broken; // 出错之后连接上的数据无法再和请求对应
+        // 接收缓冲区, [readIndex, writeIndex)为还没有解析的数据, 在多次调用之间复用
+        std::vector<char> inputBuffer;
+        size_t readIndex;
+        size_t writeIndex;
 }; 
 
 #endif
@@ -0,0 +1,148 @@
+#include "memcachedCluster.h"
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+namespace {
+
+// FNV-1a, 再用murmur3的fmix64把低位的差异扩散到高位
+uint64_t hashString(const std::string& s) {
+    uint64_t h = 14695981039346656037ULL;
+    for(unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+}
+
+void MemcachedCluster::addServer(const std::string& ip, uint16_t port) {
+    Server server;
+    server.name = ip + ":" + std::to_string(port);
+    for(auto& s : servers) {
+        if(s.name == server.name) {
+            throw std::invalid_argument("duplicate server " + server.name);
+        }
+    }
+    server.client.reset(new MemcachedClient(ip, port));
+    if(connected) {
+        server.client->connect();
+    }
+    servers.push_back(std::move(server));
+    rebuildRing();
+}
+
+void MemcachedCluster::removeServer(const std::string& ip, uint16_t port) {
+    std::string name = ip + ":" + std::to_string(port);
+    auto it = std::find_if(servers.begin(), servers.end(), [&name](const Server& s) { return s.name == name; });
+    if(it == servers.end()) {
+        throw std::invalid_argument("unknown server " + name);
+    }
+    servers.erase(it);
+    rebuildRing();
+}
+
+void MemcachedCluster::connect() {
+    for(auto& server : servers) {
+        server.client->connect();
+    }
+    connected = true;
+}
+
+// 点只由服务器的名字决定, 和加入的顺序无关
+void MemcachedCluster::rebuildRing() {
+    ring.clear();
+    ring.reserve(servers.size() * kVirtualNodes);
+    for(size_t i = 0; i < servers.size(); ++i) {
+        for(int n = 0; n < kVirtualNodes; ++n) {
+            uint64_t h = hashString(servers[i].name + "-" + std::to_string(n));
+            ring.push_back(Node{ static_cast<uint32_t>(h >> 32), i });
+        }
+    }
+    std::sort(ring.begin(), ring.end());
+}
+
+// 顺时针第一个不小于key的点, 超过最后一个点时回到第一个
+size_t MemcachedCluster::serverOf(const std::string& key) const {
+    if(ring.empty()) {
+        throw std::runtime_error("no memcached server");
+    }
+    Node node{ static_cast<uint32_t>(hashString(key) >> 32), 0 };
+    auto it = std::lower_bound(ring.begin(), ring.end(), node);
+    if(it == ring.end()) {
+        it = ring.begin();
+    }
+
+    return it->server;
+}
+
+// 一个服务器出错时仍然读完其他服务器的响应, 保证连接上没有残留的数据, 最后抛出第一个错误
+void MemcachedCluster::multiGet(const std::string& command, const std::vector<std::string>& keys,
+        bool withCas, const MemcachedClient::ValueCallback& callback) {
+    std::vector<std::vector<std::string>> groups(servers.size());
+    for(auto& key : keys) {
+        groups[serverOf(key)].push_back(key);
+    }
+
+    std::exception_ptr error;
+    std::vector<bool> sent(servers.size(), false);
+    for(size_t i = 0; i < servers.size(); ++i) {
+        if(groups[i].empty()) {
+            continue;
+        }
+        try {
+            servers[i].client->sendMultiGet(command, groups[i]);
+            sent[i] = true;
+        }
+        catch(const std::exception&) {
+            if(!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    for(size_t i = 0; i < servers.size(); ++i) {
+        if(!sent[i]) {
+            continue;
+        }
+        try {
+            servers[i].client->readValues(withCas, callback);
+        }
+        catch(const std::exception&) {
+            if(!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if(error) {
+        std::rethrow_exception(error);
+    }
+}
+
+std::map<std::string, std::string> MemcachedCluster::getMulti(const std::vector<std::string>& keys) {
+    std::map<std::string, std::string> kvs;
+    multiGet("get", keys, false, [&kvs](const std::string& key, std::string& value, int64_t) {
+        kvs[key].swap(value);
+    });
+
+    return kvs;
+}
+
+std::map<std::string, std::pair<std::string, int64_t>> MemcachedCluster::getsMulti(
+        const std::vector<std::string>& keys) {
+    std::map<std::string, std::pair<std::string, int64_t>> kvs;
+    multiGet("gets", keys, true, [&kvs](const std::string& key, std::string& value, int64_t casUnique) {
+        std::pair<std::string, int64_t>& kv = kvs[key];
+        kv.first.swap(value);
+        kv.second = casUnique;
+    });
+
+    return kvs;
+}
@@ -0,0 +1,102 @@
+#ifndef MEMCACHED_CLUSTER_H
+#define MEMCACHED_CLUSTER_H
+
+#include "memcachedClient.h"
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// 多个memcached服务器组成的集群, 用一致性hash环把key分配到服务器.
+// 每个服务器在环上有kVirtualNodes个点, 增加或删除一个服务器时只有大约1/N的key换到别的服务器
+class MemcachedCluster {
+    public:
+        MemcachedCluster() : connected(false) {}
+
+        MemcachedCluster(const MemcachedCluster&) = delete;
+
+        MemcachedCluster& operator=(const MemcachedCluster&) = delete;
+
+        // connect之后增加的服务器立即连接
+        void addServer(const std::string& ip, uint16_t port);
+
+        void removeServer(const std::string& ip, uint16_t port);
+
+        void connect();
+
+        size_t size() const { return servers.size(); }
+
+        // key所在的服务器
+        MemcachedClient& clientOf(const std::string& key) { return *servers[serverOf(key)].client; }
+
+        bool set(const std::string& key, const std::string& value, uint32_t expire = 0) {
+            return clientOf(key).set(key, value, expire);
+        }
+
+        bool add(const std::string& key, const std::string& value, uint32_t expire = 0) {
+            return clientOf(key).add(key, value, expire);
+        }
+
+        bool replace(const std::string& key, const std::string& value, uint32_t expire = 0) {
+            return clientOf(key).replace(key, value, expire);
+        }
+
+        bool append(const std::string& key, const std::string& value) { return clientOf(key).append(key, value); }
+
+        bool prepend(const std::string& key, const std::string& value) { return clientOf(key).prepend(key, value); }
+
+        bool cas(const std::string& key, const std::string& value, int64_t casUnique, uint32_t expire = 0) {
+            return clientOf(key).cas(key, value, casUnique, expire);
+        }
+
+        std::string get(std::string key) { return clientOf(key).get(key); }
+
+        uint64_t getLong(std::string key) { return clientOf(key).getLong(key); }
+
+        std::pair<std::string, int64_t> gets(std::string key) { return clientOf(key).gets(key); }
+
+        std::pair<uint64_t, int64_t> getsLong(std::string key) { return clientOf(key).getsLong(key); }
+
+        uint64_t incr(std::string key, uint64_t value) { return clientOf(key).incr(key, value); }
+
+        uint64_t decr(std::string key, uint64_t value) { return clientOf(key).decr(key, value); }
+
+        bool deleteKey(std::string key) { return clientOf(key).deleteKey(key); }
+
+        bool touch(std::string key, uint32_t expire) { return clientOf(key).touch(key, expire); }
+
+        // 按服务器拆分keys, 先向所有服务器发送请求再依次读取, 各个服务器并行处理
+        std::map<std::string, std::string> getMulti(const std::vector<std::string>& keys);
+
+        std::map<std::string, std::pair<std::string, int64_t>> getsMulti(const std::vector<std::string>& keys);
+
+    private:
+        struct Server {
+            std::string name; // ip:port, 用来计算环上的点
+            std::unique_ptr<MemcachedClient> client;
+        };
+
+        // 环上的一个点, 按point排序
+        struct Node {
+            uint32_t point;
+            size_t server;
+
+            bool operator<(const Node& other) const { return point < other.point; }
+        };
+
+        size_t serverOf(const std::string& key) const;
+        void rebuildRing();
+        void multiGet(const std::string& command, const std::vector<std::string>& keys, bool withCas,
+                const MemcachedClient::ValueCallback& callback);
+
+        const static int kVirtualNodes = 160;
+
+        std::vector<Server> servers;
+        std::vector<Node> ring;
+        bool connected;
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "memcachedPool.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+MemcachedPool::MemcachedPool(const std::string& serverIP, uint16_t port, const Options& options)
+    : serverIP(serverIP), port(port), options(options), total(0), isDown(false), backoffMillis(0),
+    quit(false), healthChecker(&MemcachedPool::healthCheckLoop, this) {
+}
+
+MemcachedPool::~MemcachedPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    stopping.notify_all();
+    healthChecker.join();
+}
+
+bool MemcachedPool::down() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return isDown;
+}
+
+std::unique_ptr<MemcachedClient> MemcachedPool::newClient() {
+    std::unique_ptr<MemcachedClient> client(new MemcachedClient(serverIP, port));
+    client->connect(options.connectTimeoutMillis);
+    client->setIoTimeout(options.ioTimeoutMillis);
+
+    return client;
+}
+
+MemcachedPool::Lease MemcachedPool::checkout() {
+    std::unique_lock<std::mutex> lock(mutex);
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(options.checkoutTimeoutMillis);
+    while(true) {
+        Clock::time_point now = Clock::now();
+        if(isDown && now < retryAt) {
+            throw std::runtime_error("memcached server " + serverIP + ":" + std::to_string(port) + " is down");
+        }
+        if(!idle.empty()) {
+            std::unique_ptr<MemcachedClient> client = std::move(idle.back().client);
+            idle.pop_back();
+            return Lease(this, std::move(client));
+        }
+        if(total < options.maxConnections) {
+            ++total;
+            // 不可用时只让一个线程去尝试, 其他线程在它完成之前直接失败
+            if(isDown) {
+                retryAt = now + std::chrono::milliseconds(backoffMillis);
+            }
+            lock.unlock();
+            std::unique_ptr<MemcachedClient> client;
+            try {
+                client = newClient();
+            }
+            catch(const std::exception&) {
+                lock.lock();
+                --total;
+                markDown(Clock::now());
+                available.notify_one();
+                throw;
+            }
+            lock.lock();
+            markUp();
+            return Lease(this, std::move(client));
+        }
+        if(available.wait_until(lock, deadline) == std::cv_status::timeout
+                && idle.empty() && total >= options.maxConnections) {
+            throw std::runtime_error("checkout memcached connection timeout");
+        }
+    }
+}
+
+void MemcachedPool::checkin(std::unique_ptr<MemcachedClient> client, bool broken) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(broken || isDown || !client->good()) {
+        client.reset();
+        --total;
+    }
+    else {
+        idle.push_back(Idle{ std::move(client), Clock::now() });
+    }
+    available.notify_one();
+}
+
+// 空闲的连接很可能已经断开, 一起关闭
+void MemcachedPool::markDown(Clock::time_point now) {
+    backoffMillis = isDown ? std::min(backoffMillis * 2, options.maxBackoffMillis) : options.minBackoffMillis;
+    isDown = true;
+    retryAt = now + std::chrono::milliseconds(backoffMillis);
+    total -= idle.size();
+    idle.clear();
+}
+
+void MemcachedPool::markUp() {
+    isDown = false;
+    backoffMillis = 0;
+}
+
+void MemcachedPool::healthCheckLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!quit) {
+        stopping.wait_for(lock, std::chrono::milliseconds(options.healthCheckMillis));
+        if(quit) {
+            break;
+        }
+        lock.unlock();
+        healthCheck();
+        lock.lock();
+    }
+}
+
+// 最近用过的连接不需要检查. 检查时把连接从idle中取出, 网络操作都在锁外进行
+void MemcachedPool::healthCheck() {
+    std::vector<Idle> checking;
+    size_t connecting = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Clock::time_point now = Clock::now();
+        Clock::time_point idleDeadline = now - std::chrono::milliseconds(options.idleTimeoutMillis);
+        Clock::time_point pingDeadline = now - std::chrono::milliseconds(options.healthCheckMillis);
+        while(!idle.empty() && idle.size() > options.minIdle && idle.front().lastUsed < idleDeadline) {
+            idle.pop_front();
+            --total;
+        }
+        while(!idle.empty() && idle.front().lastUsed < pingDeadline) {
+            checking.push_back(std::move(idle.front()));
+            idle.pop_front();
+        }
+        if(isDown) {
+            // 到了重试时间, 用一个新连接探测
+            if(now >= retryAt && total < options.maxConnections) {
+                connecting = 1;
+                retryAt = now + std::chrono::milliseconds(backoffMillis);
+            }
+        }
+        else if(idle.size() + checking.size() < options.minIdle) {
+            connecting = std::min(options.minIdle - idle.size() - checking.size(), options.maxConnections - total);
+        }
+        total += connecting;
+    }
+
+    size_t failed = 0;
+    for(auto& entry : checking) {
+        try {
+            entry.client->ping();
+        }
+        catch(const std::exception&) {
+            ++failed;
+        }
+    }
+    std::vector<std::unique_ptr<MemcachedClient>> created;
+    for(size_t i = 0; i < connecting && failed == 0; ++i) {
+        try {
+            created.push_back(newClient());
+        }
+        catch(const std::exception&) {
+            ++failed;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Clock::time_point now = Clock::now();
+    total -= checking.size() + connecting;
+    if(failed > 0) {
+        markDown(now);
+        available.notify_all();
+        return;
+    }
+    if(!created.empty()) {
+        markUp();
+    }
+    // ping不算使用, 检查过的连接保留原来的时间放回头部, 新建的连接放在尾部
+    for(auto it = checking.rbegin(); it != checking.rend(); ++it) {
+        idle.push_front(std::move(*it));
+        ++total;
+    }
+    for(auto& client : created) {
+        idle.push_back(Idle{ std::move(client), now });
+        ++total;
+    }
+    available.notify_all();
+}
@@ -0,0 +1,121 @@
+#ifndef MEMCACHED_POOL_H
+#define MEMCACHED_POOL_H
+
+#include "memcachedClient.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// 一个服务器的连接池, 可以在多个线程中使用.
+// 后台线程定期关闭空闲太久的连接, ping一段时间没有使用的连接, 并补足minIdle个空闲连接.
+// 建立连接或ping失败时认为服务器不可用, 在退避时间内checkout直接失败, 不用每次都等连接超时;
+// 退避时间从minBackoffMillis开始每次失败加倍, 直到maxBackoffMillis
+class MemcachedPool {
+    public:
+        struct Options {
+            Options() : maxConnections(8), minIdle(1), connectTimeoutMillis(200), ioTimeoutMillis(1000),
+                checkoutTimeoutMillis(100), idleTimeoutMillis(60 * 1000), healthCheckMillis(5000),
+                minBackoffMillis(500), maxBackoffMillis(30 * 1000) {}
+
+            size_t maxConnections;
+            size_t minIdle;
+            int connectTimeoutMillis;
+            int ioTimeoutMillis;
+            // 连接数已满时等待其他线程归还连接的最长时间
+            int checkoutTimeoutMillis;
+            int idleTimeoutMillis;
+            int healthCheckMillis;
+            int minBackoffMillis;
+            int maxBackoffMillis;
+        };
+
+        // 借出的连接, 析构时归还. 出错的连接不会放回池中
+        class Lease {
+            public:
+                Lease(Lease&& other)
+                    : pool(other.pool), client(std::move(other.client)), broken(other.broken) {
+                        other.pool = nullptr;
+                }
+
+                Lease(const Lease&) = delete;
+
+                Lease& operator=(const Lease&) = delete;
+
+                ~Lease() {
+                    if(pool != nullptr) {
+                        pool->checkin(std::move(client), broken);
+                    }
+                }
+
+                MemcachedClient* operator->() const { return client.get(); }
+
+                MemcachedClient& operator*() const { return *client; }
+
+                // 网络和协议错误MemcachedClient自己会记录, 其他原因不想再用这个连接时调用
+                void markBroken() { broken = true; }
+
+            private:
+                friend class MemcachedPool;
+
+                Lease(MemcachedPool* pool, std::unique_ptr<MemcachedClient> client)
+                    : pool(pool), client(std::move(client)), broken(false) {}
+
+                MemcachedPool* pool;
+                std::unique_ptr<MemcachedClient> client;
+                bool broken;
+        };
+
+        // 不会立即连接, 由后台线程建立minIdle个连接
+        MemcachedPool(const std::string& serverIP, uint16_t port, const Options& options = Options());
+
+        // 所有借出的连接必须在这之前归还
+        ~MemcachedPool();
+
+        MemcachedPool(const MemcachedPool&) = delete;
+
+        MemcachedPool& operator=(const MemcachedPool&) = delete;
+
+        // 服务器不可用或等待超时时抛出std::runtime_error
+        Lease checkout();
+
+        bool down() const;
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Idle {
+            std::unique_ptr<MemcachedClient> client;
+            Clock::time_point lastUsed;
+        };
+
+        void checkin(std::unique_ptr<MemcachedClient> client, bool broken);
+        // 在锁外调用, 失败时抛出异常
+        std::unique_ptr<MemcachedClient> newClient();
+        // 以下调用者持有mutex
+        void markDown(Clock::time_point now);
+        void markUp();
+        void healthCheckLoop();
+        void healthCheck();
+
+        const std::string serverIP;
+        const uint16_t port;
+        const Options options;
+
+        mutable std::mutex mutex;
+        std::condition_variable available; // 有连接归还或连接数减少
+        std::condition_variable stopping;
+        std::deque<Idle> idle; // 按归还时间排序, checkout取最近归还的, 空闲太久的从头部关闭
+        size_t total; // 空闲, 借出和正在建立的连接数
+        bool isDown;
+        Clock::time_point retryAt; // 不可用时, 这之后才再次尝试连接
+        int backoffMillis;
+        bool quit;
+        std::thread healthChecker;
+};
+
+#endif
@@ -0,0 +1,189 @@
+#include "memcachedRequest.h"
+
+#include <string.h>
+
+#include <stdexcept>
+#include <sstream>
+
+namespace {
+
+// 和MemcachedClient::readLine的限制相同
+const size_t kMaxLineLength = 4096;
+
+// 找到第一行的结尾, 返回行的长度, 不完整时返回-1
+ssize_t findLine(const char* data, size_t len) {
+    const char* crlf = static_cast<const char*>(::memmem(data, len, "\r\n", 2));
+    if(crlf == nullptr) {
+        if(len > kMaxLineLength) {
+            throw std::runtime_error("response line too long");
+        }
+        return -1;
+    }
+
+    return crlf - data;
+}
+
+// 只有一行的响应
+size_t parseStatus(const char* data, size_t len, const char* success, const char* failure,
+        MemcachedResponse* response) {
+    ssize_t n = findLine(data, len);
+    if(n < 0) {
+        return 0;
+    }
+    std::string line(data, n);
+    if(line == success) {
+        response->status = MemcachedResponse::kSuccess;
+    }
+    else {
+        response->status = line == failure ? MemcachedResponse::kFailure : MemcachedResponse::kError;
+        response->value.swap(line);
+    }
+
+    return n + 2;
+}
+
+// VALUE <key> <flags> <bytes> [<cas unique>]\r\n<data>\r\nEND\r\n
+size_t parseValue(const char* data, size_t len, bool withCas, MemcachedResponse* response) {
+    ssize_t n = findLine(data, len);
+    if(n < 0) {
+        return 0;
+    }
+    std::string line(data, n);
+    if(line == "END") {
+        response->status = MemcachedResponse::kFailure;
+        response->value.swap(line);
+        return n + 2;
+    }
+    std::istringstream in(line);
+    std::string token, key;
+    uint32_t flags = 0;
+    size_t bytes = 0;
+    int64_t casUnique = 0;
+    in >> token >> key >> flags >> bytes;
+    if(withCas) {
+        in >> casUnique;
+    }
+    if(token != "VALUE" || in.fail()) {
+        response->status = MemcachedResponse::kError;
+        response->value.swap(line);
+        return n + 2;
+    }
+
+    size_t total = n + 2 + bytes + 2 + 5;
+    if(len < total) {
+        return 0;
+    }
+    const char* value = data + n + 2;
+    if(::memcmp(value + bytes, "\r\nEND\r\n", 7) != 0) {
+        throw std::runtime_error("bad data block");
+    }
+    response->status = MemcachedResponse::kSuccess;
+    response->value.assign(value, bytes);
+    response->casUnique = casUnique;
+
+    return total;
+}
+
+size_t parseNumber(const char* data, size_t len, MemcachedResponse* response) {
+    ssize_t n = findLine(data, len);
+    if(n < 0) {
+        return 0;
+    }
+    std::string line(data, n);
+    if(line == "NOT_FOUND") {
+        response->status = MemcachedResponse::kFailure;
+        response->value.swap(line);
+    }
+    else if(!line.empty() && line.find_first_not_of("0123456789") == std::string::npos) {
+        response->status = MemcachedResponse::kSuccess;
+        response->number = std::stoull(line);
+    }
+    else {
+        response->status = MemcachedResponse::kError;
+        response->value.swap(line);
+    }
+
+    return n + 2;
+}
+
+}
+
+MemcachedRequest MemcachedRequest::storage(const std::string& command, const std::string& key,
+        const std::string& value, uint32_t expire) {
+    MemcachedRequest request;
+    request.type = kStorage;
+    request.header = command + " " + key + " 0 " + std::to_string(expire) + " "
+        + std::to_string(value.size()) + "\r\n";
+    request.value = value;
+
+    return request;
+}
+
+MemcachedRequest MemcachedRequest::cas(const std::string& key, const std::string& value, int64_t casUnique,
+        uint32_t expire) {
+    MemcachedRequest request;
+    request.type = kCas;
+    request.header = "cas " + key + " 0 " + std::to_string(expire) + " " + std::to_string(value.size())
+        + " " + std::to_string(casUnique) + "\r\n";
+    request.value = value;
+
+    return request;
+}
+
+MemcachedRequest MemcachedRequest::get(const std::string& key, bool withCas) {
+    MemcachedRequest request;
+    request.type = withCas ? kGets : kGet;
+    request.header = (withCas ? "gets " : "get ") + key + "\r\n";
+
+    return request;
+}
+
+MemcachedRequest MemcachedRequest::deleteKey(const std::string& key) {
+    MemcachedRequest request;
+    request.type = kDelete;
+    request.header = "delete " + key + "\r\n";
+
+    return request;
+}
+
+MemcachedRequest MemcachedRequest::arithmetic(const std::string& command, const std::string& key,
+        uint64_t value) {
+    MemcachedRequest request;
+    request.type = kArithmetic;
+    request.header = command + " " + key + " " + std::to_string(value) + "\r\n";
+
+    return request;
+}
+
+MemcachedRequest MemcachedRequest::touch(const std::string& key, uint32_t expire) {
+    MemcachedRequest request;
+    request.type = kTouch;
+    request.header = "touch " + key + " " + std::to_string(expire) + "\r\n";
+
+    return request;
+}
+
+size_t parseResponse(MemcachedRequest::Type type, const char* data, size_t len, MemcachedResponse* response) {
+    switch(type) {
+        case MemcachedRequest::kStorage:
+            return parseStatus(data, len, "STORED", "NOT_STORED", response);
+        case MemcachedRequest::kCas:
+            // 不存在时返回NOT_FOUND, 也认为是失败
+            if(len >= 11 && ::memcmp(data, "NOT_FOUND\r\n", 11) == 0) {
+                return parseStatus(data, len, "STORED", "NOT_FOUND", response);
+            }
+            return parseStatus(data, len, "STORED", "EXISTS", response);
+        case MemcachedRequest::kGet:
+            return parseValue(data, len, false, response);
+        case MemcachedRequest::kGets:
+            return parseValue(data, len, true, response);
+        case MemcachedRequest::kDelete:
+            return parseStatus(data, len, "DELETED", "NOT_FOUND", response);
+        case MemcachedRequest::kArithmetic:
+            return parseNumber(data, len, response);
+        case MemcachedRequest::kTouch:
+            return parseStatus(data, len, "TOUCHED", "NOT_FOUND", response);
+    }
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef MEMCACHED_REQUEST_H
+#define MEMCACHED_REQUEST_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// 文本协议的一个请求, 批量和异步接口共用
+struct MemcachedRequest {
+    enum Type { kStorage, kCas, kGet, kGets, kDelete, kArithmetic, kTouch };
+
+    Type type;
+    std::string header; // 命令行, 包括\r\n
+    std::string value; // 存储命令的数据, 不包括结尾的\r\n
+
+    // command为set/add/replace/append/prepend
+    static MemcachedRequest storage(const std::string& command, const std::string& key,
+            const std::string& value, uint32_t expire);
+    static MemcachedRequest cas(const std::string& key, const std::string& value, int64_t casUnique,
+            uint32_t expire);
+    static MemcachedRequest get(const std::string& key, bool withCas);
+    static MemcachedRequest deleteKey(const std::string& key);
+    static MemcachedRequest arithmetic(const std::string& command, const std::string& key, uint64_t value);
+    static MemcachedRequest touch(const std::string& key, uint32_t expire);
+};
+
+struct MemcachedResponse {
+    // kSuccess: STORED/DELETED/TOUCHED, 命中或incr/decr的结果
+    // kFailure: NOT_STORED/EXISTS/NOT_FOUND或未命中
+    // kError: 其他响应
+    enum Status { kSuccess, kFailure, kError };
+
+    MemcachedResponse() : status(kError), number(0), casUnique(0) {}
+
+    Status status;
+    std::string value; // get/gets的value; kFailure和kError时为服务器返回的那一行
+    uint64_t number; // incr/decr的结果
+    int64_t casUnique; // gets的cas unique
+};
+
+// 解析data开头的一个响应, 数据不完整时返回0, 否则返回消耗的字节数. 响应行过长时抛出异常
+size_t parseResponse(MemcachedRequest::Type type, const char* data, size_t len, MemcachedResponse* response);
+
+// 批量执行的请求, 由MemcachedClient::execute按顺序发送, 结果和请求一一对应
+class MemcachedBatch {
+    public:
+        void set(const std::string& key, const std::string& value, uint32_t expire = 0) {
+            requests.push_back(MemcachedRequest::storage("set", key, value, expire));
+        }
+
+        void add(const std::string& key, const std::string& value, uint32_t expire = 0) {
+            requests.push_back(MemcachedRequest::storage("add", key, value, expire));
+        }
+
+        void replace(const std::string& key, const std::string& value, uint32_t expire = 0) {
+            requests.push_back(MemcachedRequest::storage("replace", key, value, expire));
+        }
+
+        void append(const std::string& key, const std::string& value) {
+            requests.push_back(MemcachedRequest::storage("append", key, value, 0));
+        }
+
+        void prepend(const std::string& key, const std::string& value) {
+            requests.push_back(MemcachedRequest::storage("prepend", key, value, 0));
+        }
+
+        void cas(const std::string& key, const std::string& value, int64_t casUnique, uint32_t expire = 0) {
+            requests.push_back(MemcachedRequest::cas(key, value, casUnique, expire));
+        }
+
+        void get(const std::string& key) { requests.push_back(MemcachedRequest::get(key, false)); }
+
+        void gets(const std::string& key) { requests.push_back(MemcachedRequest::get(key, true)); }
+
+        void deleteKey(const std::string& key) { requests.push_back(MemcachedRequest::deleteKey(key)); }
+
+        void incr(const std::string& key, uint64_t value) {
+            requests.push_back(MemcachedRequest::arithmetic("incr", key, value));
+        }
+
+        void decr(const std::string& key, uint64_t value) {
+            requests.push_back(MemcachedRequest::arithmetic("decr", key, value));
+        }
+
+        void touch(const std::string& key, uint32_t expire) {
+            requests.push_back(MemcachedRequest::touch(key, expire));
+        }
+
+        size_t size() const { return requests.size(); }
+
+        void clear() { requests.clear(); }
+
+        const std::vector<MemcachedRequest>& requestList() const { return requests; }
+
+    private:
+        std::vector<MemcachedRequest> requests;
+};
+
+#endif
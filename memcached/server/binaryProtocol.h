@@ -0,0 +1,162 @@
+#ifndef MEMCACHED_BINARY_PROTOCOL_H
+#define MEMCACHED_BINARY_PROTOCOL_H
+
+#include "muduo/net/Buffer.h"
+#include "muduo/net/Endian.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// memcached二进制协议, 请求和回复都以24字节的header开头, 多字节字段为网络字节序:
+// magic opcode keyLength(2) extrasLength dataType status/reserved(2)
+// bodyLength(4) opaque(4) cas(8), 之后依次是extras, key, value
+namespace binary {
+
+const uint8_t kRequestMagic = 0x80;
+const uint8_t kResponseMagic = 0x81;
+const size_t kHeaderSize = 24;
+// 最长的extras: incr/decr的delta(8), initial(8)和expiration(4)
+const size_t kMaxExtrasSize = 20;
+
+enum Opcode {
+    kGet = 0x00,
+    kSet = 0x01,
+    kAdd = 0x02,
+    kReplace = 0x03,
+    kDelete = 0x04,
+    kIncrement = 0x05,
+    kDecrement = 0x06,
+    kQuit = 0x07,
+    kFlush = 0x08,
+    kGetQ = 0x09,
+    kNoop = 0x0a,
+    kVersion = 0x0b,
+    kGetK = 0x0c,
+    kGetKQ = 0x0d,
+    kAppend = 0x0e,
+    kPrepend = 0x0f,
+    kStat = 0x10,
+    kSetQ = 0x11,
+    kAddQ = 0x12,
+    kReplaceQ = 0x13,
+    kDeleteQ = 0x14,
+    kIncrementQ = 0x15,
+    kDecrementQ = 0x16,
+    kQuitQ = 0x17,
+    kFlushQ = 0x18,
+    kAppendQ = 0x19,
+    kPrependQ = 0x1a,
+    kTouch = 0x1c,
+    kGat = 0x1d,
+    kGatQ = 0x1e,
+    kGatK = 0x23,
+    kGatKQ = 0x24
+};
+
+enum Status {
+    kSuccess = 0x00,
+    kKeyNotFound = 0x01,
+    kKeyExists = 0x02,
+    kTooLarge = 0x03,
+    kInvalidArguments = 0x04,
+    kNotStored = 0x05,
+    kNonNumeric = 0x06,
+    kUnknownCommand = 0x81,
+    kOutOfMemory = 0x82
+};
+
+// 解码后的header, 字段为主机字节序
+struct Header {
+    uint8_t magic;
+    uint8_t opcode;
+    uint16_t keyLength;
+    uint8_t extrasLength;
+    uint8_t dataType;
+    uint16_t status;       // 请求中为保留字段
+    uint32_t bodyLength;
+    uint32_t opaque;
+    uint64_t cas;
+};
+
+inline uint16_t readUint16(const char* data) {
+    uint16_t be;
+    ::memcpy(&be, data, sizeof be);
+    return muduo::net::sockets::networkToHost16(be);
+}
+
+inline uint32_t readUint32(const char* data) {
+    uint32_t be;
+    ::memcpy(&be, data, sizeof be);
+    return muduo::net::sockets::networkToHost32(be);
+}
+
+inline uint64_t readUint64(const char* data) {
+    uint64_t be;
+    ::memcpy(&be, data, sizeof be);
+    return muduo::net::sockets::networkToHost64(be);
+}
+
+// data至少有kHeaderSize字节
+inline Header parseHeader(const char* data) {
+    Header header;
+    header.magic = static_cast<uint8_t>(data[0]);
+    header.opcode = static_cast<uint8_t>(data[1]);
+    header.keyLength = readUint16(data + 2);
+    header.extrasLength = static_cast<uint8_t>(data[4]);
+    header.dataType = static_cast<uint8_t>(data[5]);
+    header.status = readUint16(data + 6);
+    header.bodyLength = readUint32(data + 8);
+    header.opaque = readUint32(data + 12);
+    header.cas = readUint64(data + 16);
+
+    return header;
+}
+
+inline void appendHeader(muduo::net::Buffer* buf, const Header& header) {
+    buf->appendInt8(static_cast<int8_t>(header.magic));
+    buf->appendInt8(static_cast<int8_t>(header.opcode));
+    buf->appendInt16(static_cast<int16_t>(header.keyLength));
+    buf->appendInt8(static_cast<int8_t>(header.extrasLength));
+    buf->appendInt8(static_cast<int8_t>(header.dataType));
+    buf->appendInt16(static_cast<int16_t>(header.status));
+    buf->appendInt32(static_cast<int32_t>(header.bodyLength));
+    buf->appendInt32(static_cast<int32_t>(header.opaque));
+    buf->appendInt64(static_cast<int64_t>(header.cas));
+}
+
+// quiet命令只在出错时回复(GETQ/GETKQ/GATQ/GATKQ在未命中时不回复)
+inline bool isQuiet(uint8_t opcode) {
+    switch(opcode) {
+        case kGetQ: case kGetKQ: case kSetQ: case kAddQ: case kReplaceQ:
+        case kDeleteQ: case kIncrementQ: case kDecrementQ: case kQuitQ:
+        case kFlushQ: case kAppendQ: case kPrependQ: case kGatQ: case kGatKQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// quiet命令对应的普通命令
+inline uint8_t loudOpcode(uint8_t opcode) {
+    switch(opcode) {
+        case kGetQ: return kGet;
+        case kGetKQ: return kGetK;
+        case kSetQ: return kSet;
+        case kAddQ: return kAdd;
+        case kReplaceQ: return kReplace;
+        case kDeleteQ: return kDelete;
+        case kIncrementQ: return kIncrement;
+        case kDecrementQ: return kDecrement;
+        case kQuitQ: return kQuit;
+        case kFlushQ: return kFlush;
+        case kAppendQ: return kAppend;
+        case kPrependQ: return kPrepend;
+        case kGatQ: return kGat;
+        case kGatKQ: return kGatK;
+        default: return opcode;
+    }
+}
+
+}
+
+#endif
@@ -1,63 +1,57 @@
 #include "item.h"
+#include "relTime.h"
+#include "slabs.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <new>
+
+Item::Item(SlabAllocator* slabs, unsigned int clsid, const muduo::StringPiece& key, uint64_t hash,
+        size_t nbytes, uint16_t flags, uint32_t expireTime, uint64_t cas)
+    : slabs(slabs), prev(nullptr), next(nullptr), linked(false), refcount(1),
+      time(RelTime::now()),
+      expireTime(expireTime), casUnique(cas), keyHash(hash),
+      nbytes(static_cast<uint32_t>(nbytes)), flags(flags),
+      nkey(static_cast<uint8_t>(key.size())), slabsClsid(static_cast<uint8_t>(clsid)), numeric(false) {
+    ::memcpy(data(), key.data(), key.size());
+}
+
+Item* Item::create(SlabAllocator* slabs, unsigned int clsid, const muduo::StringPiece& key,
+        uint64_t hash, size_t nbytes, uint16_t flags, uint32_t expireTime, uint64_t cas) {
+    assert(key.size() <= UINT8_MAX);
+    assert(clsid == slabs->classId(totalSize(key.size(), nbytes)));
+    void* chunk = slabs->alloc(clsid);
+    if(chunk == nullptr) {
+        return nullptr;
+    }
 
-#include "muduo/base/Timestamp.h"
-
-Item::Item(const std::string& key, const std::string& value, 
-        uint16_t flags, uint32_t expireTime, uint64_t cas) 
-    : key(key), value(value), flags(flags), expireTime(expireTime), casUnique(cas) {
-}
-
-void Item::set(const std::string& value, uint16_t flags, uint32_t exptime, uint64_t cas) {
-    this->value = value;
-    this->flags = flags;
-    this->expireTime = exptime;
-    casUnique = cas;
-}
-
-std::string Item::get() const {
-    return value;
-}
-
-std::pair<std::string, uint64_t> Item::gets() const {
-    return std::make_pair(value, casUnique);
-}
-
-void Item::append(const std::string& app, uint64_t cas) {
-    value += app;
-    casUnique = cas;
-}
-
-void Item::prepend(const std::string& pre, uint64_t cas) {
-    value = pre + value;
-    casUnique = cas;
+    return new (chunk) Item(slabs, clsid, key, hash, nbytes, flags, expireTime, cas);
 }
 
-bool Item::isExpire() {
-    uint32_t current = static_cast<uint32_t>(muduo::Timestamp::now().secondsSinceEpoch());
-    return (expireTime != 0 && current >= expireTime);
+void Item::decrRef() const {
+    if(--refcount == 0) {
+        SlabAllocator* owner = slabs;
+        unsigned int clsid = slabsClsid;
+        this->~Item();
+        owner->free(const_cast<Item*>(this), clsid);
+    }
 }
 
-// 相加后溢出(回绕)
-uint64_t Item::incr(uint64_t increment, uint64_t cas) {
-    uint64_t v = std::stoull(value) + increment;
-    value = std::to_string(v);
-    casUnique = cas;
-
-    return v;
+void Item::initNumber(uint64_t n) {
+    assert(nbytes == kNumberBytes);
+    new (numberSlot()) std::atomic<uint64_t>(n);
+    numeric = true;
 }
 
-uint64_t Item::decr(uint64_t decrement, uint64_t cas) {
-    uint64_t num = std::stoull(value);
-    uint64_t v = 0;
-    if(decrement < num) {
-        v = std::stoull(value) - decrement;
+muduo::StringPiece Item::value(char* buf) const {
+    if(!numeric) {
+        return value();
     }
-    value = std::to_string(v);
-    casUnique = cas;
 
-    return v;
+    return muduo::StringPiece(buf, static_cast<int>(formatUint(getNumber(), buf)));
 }
 
 void Item::touch(uint32_t expireTime) {
-    this->expireTime = expireTime;
+    this->expireTime.store(expireTime, std::memory_order_relaxed);
 }
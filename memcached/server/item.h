@@ -1,41 +1,149 @@
 #ifndef MEMCACHED_ITEM_H
 #define MEMCACHED_ITEM_H
 
+#include "util.h"
+
+#include "muduo/base/StringPiece.h"
+
+#include <boost/intrusive_ptr.hpp>
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <atomic>
 #include <iostream>
 
+class SlabAllocator;
+
+// item头部之后紧跟key和value, 整个item放在一个slab chunk中.
+// 通过引用计数管理, 计数为0时chunk归还给SlabAllocator.
+// incr/decr之后的item以uint64_t保存数字, 读取时才格式化成文本.
 class Item {
     public:
-        Item(const std::string& key, const std::string& value,
-                uint16_t flags, uint32_t expireTime, uint64_t cas);
+        // 保存数字的item需要的value大小, 多出来的字节用于对齐
+        const static size_t kNumberBytes = sizeof(uint64_t) + alignof(uint64_t) - 1;
 
-        void set(const std::string& newValue, uint16_t flags, uint32_t exptime, uint64_t cas);
+        // 在slab class clsid中分配一个item, 引用计数为1; 内存不足时返回nullptr
+        // hash为hashKey(key)
+        static Item* create(SlabAllocator* slabs, unsigned int clsid, const muduo::StringPiece& key,
+                uint64_t hash, size_t nbytes, uint16_t flags, uint32_t expireTime, uint64_t cas);
 
-        std::string get() const;
+        // 整个item(头部 + key + value)占用的字节数
+        static size_t totalSize(size_t nkey, size_t nbytes) { return sizeof(Item) + nkey + nbytes; }
 
-        std::pair<std::string, uint64_t> gets() const;
+        Item(const Item&) = delete;
 
-        void append(const std::string& app, uint64_t cas);
+        Item& operator=(const Item&) = delete;
 
-        void prepend(const std::string& pre, uint64_t cas);
+        muduo::StringPiece key() const {
+            return muduo::StringPiece(data(), nkey);
+        }
 
-        uint64_t incr(uint64_t increment, uint64_t cas);
+        uint64_t hash() const { return keyHash; }
 
-        uint64_t decr(uint64_t decrement, uint64_t cas);
+        // 只能用于文本形式的item
+        muduo::StringPiece value() const {
+            assert(!numeric);
+            return muduo::StringPiece(data() + nkey, static_cast<int>(nbytes));
+        }
 
-        void touch(uint32_t expireTime);
+        // 数字格式化到buf(至少kMaxUint64Length字节)中, 文本形式的item直接返回value()
+        muduo::StringPiece value(char* buf) const;
+
+        char* valueData() { return data() + nkey; }
+
+        // value占用的字节数, 数字为kNumberBytes
+        size_t size() const { return nbytes; }
 
-        bool isExpire();
+        bool isNumber() const { return numeric; }
+
+        // 在item加入hash表之前调用, value大小必须是kNumberBytes
+        void initNumber(uint64_t n);
+
+        uint64_t getNumber() const { return numberSlot()->load(std::memory_order_relaxed); }
+
+        // 原地修改数字, 调用者持有shard的锁, 无锁读者读到的是修改前或修改后的值
+        void setNumber(uint64_t n, uint64_t cas) {
+            numberSlot()->store(n, std::memory_order_relaxed);
+            casUnique.store(cas, std::memory_order_relaxed);
+        }
+
+        // 从快照恢复时使用快照中的cas, 在item加入hash表之前调用
+        void setCas(uint64_t cas) { casUnique.store(cas, std::memory_order_relaxed); }
+
+        size_t totalSize() const { return totalSize(nkey, nbytes); }
+
+        void touch(uint32_t expireTime);
 
         uint16_t getFlags() const { return flags; }
 
-        uint64_t getCas() const { return casUnique; }
+        uint32_t getExpireTime() const { return expireTime.load(std::memory_order_relaxed); }
+
+        uint64_t getCas() const { return casUnique.load(std::memory_order_relaxed); }
+
+        unsigned int slabsClass() const { return slabsClsid; }
+
+        // 最近一次访问的时间(RelTime)
+        uint32_t getTime() const { return time.load(std::memory_order_relaxed); }
+
+        uint32_t refs() const { return refcount; }
+
+        void incrRef() const { ++refcount; }
+
+        // 引用计数不为0时才加1, 用于无锁查找: 此时item可能已经被释放
+        bool tryIncrRef() const {
+            uint32_t n = refcount.load();
+            while(n != 0) {
+                if(refcount.compare_exchange_weak(n, n + 1)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void decrRef() const;
 
     private:
-        std::string key;
-        std::string value;
+        friend class Lru;
+
+        Item(SlabAllocator* slabs, unsigned int clsid, const muduo::StringPiece& key, uint64_t hash,
+                size_t nbytes, uint16_t flags, uint32_t expireTime, uint64_t cas);
+
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+        const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+
+        // value区域中按8字节对齐的位置
+        std::atomic<uint64_t>* numberSlot() const {
+            uintptr_t p = reinterpret_cast<uintptr_t>(data() + nkey);
+            p = (p + alignof(uint64_t) - 1) & ~static_cast<uintptr_t>(alignof(uint64_t) - 1);
+            return reinterpret_cast<std::atomic<uint64_t>*>(p);
+        }
+
+        SlabAllocator* slabs;
+        Item* prev;   // LRU链表, 由Lru维护
+        Item* next;
+        bool linked;  // 是否在LRU链表中, 只在持有LRU锁时修改和读取
+        mutable std::atomic<uint32_t> refcount;
+        // 无锁读者读取时可能正在被touch或LRU修改, 只需要原子性, 用relaxed访问
+        std::atomic<uint32_t> time;
+        std::atomic<uint32_t> expireTime; // RelTime, 0表示永不过期
+        std::atomic<uint64_t> casUnique; // 数字原地修改时会更新
+        uint64_t keyHash; // 比较key之前先比较hash, 删除时不用重新计算
+        uint32_t nbytes;
         uint16_t flags;
-        uint32_t expireTime; // using timestamp
-        uint64_t casUnique;
+        uint8_t nkey;
+        uint8_t slabsClsid;
+        bool numeric;
 };
 
+inline void intrusive_ptr_add_ref(const Item* item) {
+    item->incrRef();
+}
+
+inline void intrusive_ptr_release(const Item* item) {
+    item->decrRef();
+}
+
+typedef boost::intrusive_ptr<const Item> ItemPtr;
+
 #endif
@@ -0,0 +1,302 @@
+#include "itemTable.h"
+
+#include <assert.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+bool keyEquals(const Item* item, const muduo::StringPiece& key, uint64_t hash) {
+    if(item->hash() != hash) {
+        return false;
+    }
+    muduo::StringPiece itemKey = item->key();
+    return itemKey.size() == key.size() && ::memcmp(itemKey.data(), key.data(), key.size()) == 0;
+}
+
+}
+
+ItemTable::Table::Table(size_t numGroups)
+    : groupMask(numGroups - 1), used(0), live(0), groups(new Group[numGroups]) {
+        clear();
+}
+
+void ItemTable::Table::clear() {
+    for(size_t g = 0; g <= groupMask; ++g) {
+        ::memset(groups[g].ctrl, kEmpty, kGroupSize);
+        for(int i = 0; i < kGroupSize; ++i) {
+            groups[g].slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    used = 0;
+    live = 0;
+}
+
+ItemTable::ItemTable() : version(0), active(nullptr), oldTable(nullptr), migrated(0) {
+}
+
+void ItemTable::init(size_t slots) {
+    size_t numGroups = 1;
+    while(numGroups * kGroupSize * 7 < slots * 8) {
+        numGroups *= 2;
+    }
+    tables.clear();
+    tables.emplace_back(new Table(numGroups));
+    active.store(tables.back().get(), std::memory_order_release);
+    oldTable.store(nullptr, std::memory_order_release);
+    migrated = 0;
+}
+
+uint32_t ItemTable::match(const Group& group, uint8_t c) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group.ctrl));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(c)))));
+#else
+    uint32_t bits = 0;
+    for(int i = 0; i < kGroupSize; ++i) {
+        if(group.ctrl[i] == c) {
+            bits |= 1u << i;
+        }
+    }
+    return bits;
+#endif
+}
+
+// 空和删除标记的最高位都是1
+uint32_t ItemTable::matchFree(const Group& group) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group.ctrl));
+    return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+#else
+    uint32_t bits = 0;
+    for(int i = 0; i < kGroupSize; ++i) {
+        if(group.ctrl[i] & 0x80) {
+            bits |= 1u << i;
+        }
+    }
+    return bits;
+#endif
+}
+
+// 按组做三角数探测, 组数为2的幂时会访问到所有的组. 遇到有空slot的组时停止,
+// 无锁读者读到正在修改的表也最多探测groupMask + 1组
+Item* ItemTable::findIn(const Table* table, const muduo::StringPiece& key, uint64_t hash,
+        std::memory_order order) {
+    uint8_t tag = tagOf(hash);
+    size_t g = hash & table->groupMask;
+    for(size_t step = 0; step <= table->groupMask; ++step) {
+        const Group& group = table->groups[g];
+        for(uint32_t bits = match(group, tag); bits != 0; bits &= bits - 1) {
+            Item* item = group.slots[__builtin_ctz(bits)].load(order);
+            if(item != nullptr && keyEquals(item, key, hash)) {
+                return item;
+            }
+        }
+        if(match(group, kEmpty) != 0) {
+            break;
+        }
+        g = (g + step + 1) & table->groupMask;
+    }
+
+    return nullptr;
+}
+
+Item* ItemTable::find(const muduo::StringPiece& key, uint64_t hash) const {
+    Item* item = findIn(active.load(std::memory_order_relaxed), key, hash, std::memory_order_relaxed);
+    const Table* from = oldTable.load(std::memory_order_relaxed);
+    if(item == nullptr && from != nullptr) {
+        item = findIn(from, key, hash, std::memory_order_relaxed);
+    }
+
+    return item;
+}
+
+void ItemTable::locate(const Item* item, Table** table, Group** group, int* index) const {
+    Table* candidates[2] = { active.load(std::memory_order_relaxed), oldTable.load(std::memory_order_relaxed) };
+    uint8_t tag = tagOf(item->hash());
+    for(Table* t : candidates) {
+        if(t == nullptr) {
+            continue;
+        }
+        size_t g = item->hash() & t->groupMask;
+        for(size_t step = 0; step <= t->groupMask; ++step) {
+            Group& current = t->groups[g];
+            for(uint32_t bits = match(current, tag); bits != 0; bits &= bits - 1) {
+                int i = __builtin_ctz(bits);
+                if(current.slots[i].load(std::memory_order_relaxed) == item) {
+                    *table = t;
+                    *group = &current;
+                    *index = i;
+                    return;
+                }
+            }
+            if(match(current, kEmpty) != 0) {
+                break;
+            }
+            g = (g + step + 1) & t->groupMask;
+        }
+    }
+    assert(false && "item not in table");
+}
+
+void ItemTable::insertInto(Table* table, Item* item) {
+    size_t g = item->hash() & table->groupMask;
+    for(size_t step = 0; step <= table->groupMask; ++step) {
+        Group& group = table->groups[g];
+        uint32_t bits = matchFree(group);
+        if(bits != 0) {
+            int i = __builtin_ctz(bits);
+            if(group.ctrl[i] == kEmpty) {
+                ++table->used;
+            }
+            ++table->live;
+            group.slots[i].store(item, std::memory_order_release);
+            group.ctrl[i] = tagOf(item->hash());
+            return;
+        }
+        g = (g + step + 1) & table->groupMask;
+    }
+    assert(false && "item table is full");
+}
+
+// 组中还有空slot时, 经过这一组的探测本来就会在这里停止, 可以直接标记为空
+void ItemTable::erase(Table* table, Group* group, int index) {
+    group->slots[index].store(nullptr, std::memory_order_release);
+    if(match(*group, kEmpty) != 0) {
+        group->ctrl[index] = kEmpty;
+        --table->used;
+    }
+    else {
+        group->ctrl[index] = kDeleted;
+    }
+    --table->live;
+}
+
+// 迁移期间每次修改最多插入一个item, 新表在迁移完成之前不会超过7/8.
+// 调用时没有正在迁移的表, 除了active之外的表都可以复用, 还在读旧表的无锁读者会因为version改变而重试
+void ItemTable::growIfNeeded() {
+    Table* table = active.load(std::memory_order_relaxed);
+    if(oldTable.load(std::memory_order_relaxed) != nullptr || (table->used + 1) * 8 <= table->capacity() * 7) {
+        return;
+    }
+    size_t numGroups = table->groupMask + 1;
+    // 大部分是删除标记时只需要重建同样大小的表
+    if(table->live * 16 >= table->capacity() * 7) {
+        numGroups *= 2;
+    }
+    Table* next = nullptr;
+    for(auto& t : tables) {
+        if(t.get() != table && t->groupMask + 1 == numGroups) {
+            next = t.get();
+            next->clear();
+            break;
+        }
+    }
+    if(next == nullptr) {
+        tables.emplace_back(new Table(numGroups));
+        next = tables.back().get();
+    }
+    oldTable.store(table, std::memory_order_release);
+    active.store(next, std::memory_order_release);
+    migrated = 0;
+}
+
+void ItemTable::migrate() {
+    Table* from = oldTable.load(std::memory_order_relaxed);
+    if(from == nullptr) {
+        return;
+    }
+    Table* to = active.load(std::memory_order_relaxed);
+    size_t numGroups = from->groupMask + 1;
+    for(size_t n = 0; n < kMigrateGroups && migrated < numGroups; ++n, ++migrated) {
+        Group& group = from->groups[migrated];
+        for(int i = 0; i < kGroupSize; ++i) {
+            Item* item = group.slots[i].load(std::memory_order_relaxed);
+            if(item != nullptr) {
+                insertInto(to, item);
+                group.slots[i].store(nullptr, std::memory_order_release);
+                group.ctrl[i] = kDeleted;
+            }
+        }
+    }
+    if(migrated == numGroups) {
+        oldTable.store(nullptr, std::memory_order_release);
+    }
+}
+
+void ItemTable::beginWrite() {
+    version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void ItemTable::endWrite() {
+    version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void ItemTable::insert(Item* item) {
+    beginWrite();
+    growIfNeeded();
+    migrate();
+    insertInto(active.load(std::memory_order_relaxed), item);
+    endWrite();
+}
+
+void ItemTable::remove(Item* item) {
+    beginWrite();
+    migrate();
+    Table* table = nullptr;
+    Group* group = nullptr;
+    int index = 0;
+    locate(item, &table, &group, &index);
+    erase(table, group, index);
+    endWrite();
+}
+
+void ItemTable::replace(Item* old, Item* item) {
+    assert(old->hash() == item->hash());
+    beginWrite();
+    migrate();
+    Table* table = nullptr;
+    Group* group = nullptr;
+    int index = 0;
+    locate(old, &table, &group, &index);
+    group->slots[index].store(item, std::memory_order_release);
+    endWrite();
+}
+
+// 读到的item可能正在被删除甚至已经被复用, 所以只有在引用计数加1之后
+// version仍然没有变化, 才能确定它在加引用时还在表中
+bool ItemTable::tryAcquire(const muduo::StringPiece& key, uint64_t hash, Item** result) const {
+    uint32_t start = version.load(std::memory_order_acquire);
+    if(start & 1) {
+        return false;
+    }
+    Item* found = nullptr;
+    const Table* candidates[2] = { active.load(std::memory_order_acquire), oldTable.load(std::memory_order_acquire) };
+    for(const Table* table : candidates) {
+        if(table == nullptr) {
+            continue;
+        }
+        Item* item = findIn(table, key, hash, std::memory_order_acquire);
+        if(item != nullptr) {
+            if(!item->tryIncrRef()) {
+                return false;
+            }
+            found = item;
+            break;
+        }
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(version.load(std::memory_order_relaxed) != start) {
+        if(found != nullptr) {
+            found->decrRef();
+        }
+        return false;
+    }
+    *result = found;
+
+    return true;
+}
@@ -0,0 +1,127 @@
+#ifndef MEMCACHED_ITEM_TABLE_H
+#define MEMCACHED_ITEM_TABLE_H
+
+#include "item.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// 一个shard的hash表, 开放寻址. 每16个slot为一组, 每组有16字节的控制字节,
+// 保存hashKey()中的7位tag或者空/删除标记, 查找时用SSE2一次比较一组的tag.
+// 修改操作由调用者持有shard的锁; 查找可以不加锁, 通过version(seqlock)检测并发修改.
+// 表满时分配新表, 之后每次修改迁移kMigrateGroups组, 迁移期间两个表都要查找.
+// item的chunk只会被复用而不会还给系统, 迁移完的旧表也不释放, 下次需要同样大小的表时清空后复用,
+// 所以无锁读访问已删除的item或旧表都是安全的, 读到复用中的表时version已经改变.
+// 每种大小最多两个表, 反复重建同样大小的表时内存不会增长
+class ItemTable {
+    public:
+        ItemTable();
+
+        ItemTable(const ItemTable&) = delete;
+
+        ItemTable& operator=(const ItemTable&) = delete;
+
+        // 在使用前调用一次, slots为预计的item数目
+        void init(size_t slots);
+
+        // 以下函数需要持有shard的锁
+        Item* find(const muduo::StringPiece& key, uint64_t hash) const;
+        // 表中没有相同的key
+        void insert(Item* item);
+        void remove(Item* item);
+        // 用item替换表中的old, key相同
+        void replace(Item* old, Item* item);
+
+        template<typename Func>
+        void forEach(Func func) const {
+            const Table* tables[2] = { active.load(std::memory_order_relaxed), oldTable.load(std::memory_order_relaxed) };
+            for(const Table* table : tables) {
+                if(table == nullptr) {
+                    continue;
+                }
+                for(size_t g = 0; g <= table->groupMask; ++g) {
+                    for(int i = 0; i < kGroupSize; ++i) {
+                        Item* item = table->groups[g].slots[i].load(std::memory_order_relaxed);
+                        if(item != nullptr) {
+                            func(item);
+                        }
+                    }
+                }
+            }
+        }
+
+        // 不加锁查找. 找到的item引用计数加1后写入result(没找到时为nullptr).
+        // 查找期间表被修改时返回false, 调用者可以重试或者加锁查找
+        bool tryAcquire(const muduo::StringPiece& key, uint64_t hash, Item** result) const;
+
+        // 预取第一个探测的组, 批量查找时先对所有key调用, 让内存访问重叠
+        void prefetch(uint64_t hash) const {
+            const Table* table = active.load(std::memory_order_acquire);
+            __builtin_prefetch(&table->groups[hash & table->groupMask]);
+        }
+
+    private:
+        const static int kGroupSize = 16;
+        const static uint8_t kEmpty = 0x80;
+        const static uint8_t kDeleted = 0xfe;
+        // 每次修改时从旧表迁移的组数
+        const static size_t kMigrateGroups = 8;
+
+        // 控制字节最高位为0时是slot中item的tag
+        struct Group {
+            uint8_t ctrl[kGroupSize];
+            std::atomic<Item*> slots[kGroupSize];
+        };
+
+        // 创建之后groupMask和groups不再改变, 无锁读者可以安全地读取
+        struct Table {
+            explicit Table(size_t numGroups);
+
+            // 所有slot置为空, 用于复用旧表
+            void clear();
+
+            size_t capacity() const { return (groupMask + 1) * kGroupSize; }
+
+            size_t groupMask;
+            size_t used;  // 不为空的slot数, 包括删除标记
+            size_t live;
+            std::unique_ptr<Group[]> groups;
+        };
+
+        // hashKey()的高12位选择shard, 低位选择组, tag取中间的7位
+        static uint8_t tagOf(uint64_t hash) { return static_cast<uint8_t>((hash >> 44) & 0x7f); }
+
+        // 组中控制字节等于c的slot, 第i位对应第i个slot
+        static uint32_t match(const Group& group, uint8_t c);
+        // 组中空的或已删除的slot
+        static uint32_t matchFree(const Group& group);
+
+        // 在table中查找key, 没找到时返回nullptr
+        static Item* findIn(const Table* table, const muduo::StringPiece& key, uint64_t hash,
+                std::memory_order order);
+
+        // 找到item所在的表和slot, item必须在表中
+        void locate(const Item* item, Table** table, Group** group, int* index) const;
+
+        static void insertInto(Table* table, Item* item);
+        static void erase(Table* table, Group* group, int index);
+
+        // 插入之前调用, 装载率超过7/8时开始迁移到新表
+        void growIfNeeded();
+        // 迁移旧表的kMigrateGroups组
+        void migrate();
+
+        void beginWrite();
+        void endWrite();
+
+        std::atomic<uint32_t> version; // 奇数表示正在修改
+        std::atomic<Table*> active;
+        std::atomic<Table*> oldTable;      // 正在迁移的旧表, 没有迁移时为nullptr
+        size_t migrated;               // 旧表中已迁移的组数
+        std::vector<std::unique_ptr<Table>> tables; // 分配过的所有表, 不是active和oldTable的可以复用
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef MEMCACHED_KEY_HASH_H
+#define MEMCACHED_KEY_HASH_H
+
+#include "muduo/base/StringPiece.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// key的64位hash, 算法同wyhash(final v4). 每个请求只计算一次:
+// 高位选择shard, 低位选择shard内的bucket, 并保存在item中用于比较和删除.
+namespace keyhash {
+
+const uint64_t kSecret[4] = { 0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+                              0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull };
+
+// 128位乘积, 低64位写入a, 高64位写入b
+inline void mum(uint64_t* a, uint64_t* b) {
+    __uint128_t r = static_cast<__uint128_t>(*a) * *b;
+    *a = static_cast<uint64_t>(r);
+    *b = static_cast<uint64_t>(r >> 64);
+}
+
+inline uint64_t mix(uint64_t a, uint64_t b) {
+    mum(&a, &b);
+    return a ^ b;
+}
+
+inline uint64_t read64(const char* p) {
+    uint64_t v;
+    ::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t read32(const char* p) {
+    uint32_t v;
+    ::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// 1到3个字节
+inline uint64_t read3(const char* p, size_t len) {
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(p);
+    return (static_cast<uint64_t>(s[0]) << 16) | (static_cast<uint64_t>(s[len >> 1]) << 8) | s[len - 1];
+}
+
+}
+
+inline uint64_t hashKey(const muduo::StringPiece& key, uint64_t seed = 0) {
+    using namespace keyhash;
+    const char* p = key.data();
+    size_t len = static_cast<size_t>(key.size());
+    seed ^= mix(seed ^ kSecret[0], kSecret[1]);
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if(len <= 16) {
+        if(len >= 4) {
+            a = (read32(p) << 32) | read32(p + ((len >> 3) << 2));
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if(len > 0) {
+            a = read3(p, len);
+        }
+    }
+    else {
+        size_t i = len;
+        if(i > 48) {
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do {
+                seed = mix(read64(p) ^ kSecret[1], read64(p + 8) ^ seed);
+                seed1 = mix(read64(p + 16) ^ kSecret[2], read64(p + 24) ^ seed1);
+                seed2 = mix(read64(p + 32) ^ kSecret[3], read64(p + 40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while(i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while(i > 16) {
+            seed = mix(read64(p) ^ kSecret[1], read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+    a ^= kSecret[1];
+    b ^= seed;
+    mum(&a, &b);
+
+    return mix(a ^ kSecret[0] ^ len, b ^ kSecret[1]);
+}
+
+#endif
@@ -0,0 +1,136 @@
+#include "lru.h"
+
+#include "relTime.h"
+
+#include <assert.h>
+
+namespace {
+
+uint32_t now() {
+    return RelTime::now();
+}
+
+}
+
+Lru::Lru() {
+}
+
+void Lru::linkLocked(List& list, Item* item) {
+    item->prev = nullptr;
+    item->next = list.head;
+    if(list.head != nullptr) {
+        list.head->prev = item;
+    }
+    list.head = item;
+    if(list.tail == nullptr) {
+        list.tail = item;
+    }
+    item->linked = true;
+    list.size++;
+}
+
+void Lru::unlinkLocked(List& list, Item* item) {
+    assert(item->linked);
+    if(list.head == item) {
+        list.head = item->next;
+    }
+    if(list.tail == item) {
+        list.tail = item->prev;
+    }
+    if(item->next != nullptr) {
+        item->next->prev = item->prev;
+    }
+    if(item->prev != nullptr) {
+        item->prev->next = item->next;
+    }
+    item->prev = item->next = nullptr;
+    item->linked = false;
+    list.size--;
+}
+
+void Lru::link(Item* item) {
+    List& list = lists[item->slabsClass()];
+    std::lock_guard<std::mutex> lock(list.lock);
+    linkLocked(list, item);
+}
+
+void Lru::unlink(Item* item) {
+    List& list = lists[item->slabsClass()];
+    std::lock_guard<std::mutex> lock(list.lock);
+    unlinkLocked(list, item);
+}
+
+void Lru::bump(Item* item) {
+    uint32_t current = now();
+    if(item->getTime() + kUpdateInterval >= current) {
+        return;
+    }
+    List& list = lists[item->slabsClass()];
+    std::lock_guard<std::mutex> lock(list.lock);
+    // 读者不持有shard锁, item可能已经被并发的替换, 删除或淘汰移出了链表
+    if(!item->linked) {
+        return;
+    }
+    unlinkLocked(list, item);
+    item->time.store(current, std::memory_order_relaxed);
+    linkLocked(list, item);
+}
+
+bool Lru::evict(unsigned int clsid, const EvictCallback& cb, const ExpiredCallback& isExpired, bool* expired) {
+    List& list = lists[clsid];
+    std::lock_guard<std::mutex> lock(list.lock);
+    Item* item = list.tail;
+    for(int i = 0; i < kSearchItems && item != nullptr; ++i, item = item->prev) {
+        // 还被其他连接引用的item释放不了内存
+        if(item->refs() > 1 || !cb(item)) {
+            continue;
+        }
+
+        if(isExpired(item)) {
+            list.reclaimed++;
+            *expired = true;
+        }
+        else {
+            list.evicted++;
+            if(item->getExpireTime() != 0) {
+                list.evictedNonzero++;
+            }
+            *expired = false;
+        }
+        unlinkLocked(list, item);
+        // 释放hash表持有的引用
+        item->decrRef();
+        return true;
+    }
+
+    return false;
+}
+
+void Lru::addOutOfMemory(unsigned int clsid) {
+    List& list = lists[clsid];
+    std::lock_guard<std::mutex> lock(list.lock);
+    list.outOfMemory++;
+}
+
+std::vector<LruClassStat> Lru::stats() const {
+    std::vector<LruClassStat> result;
+    uint32_t current = now();
+    for(unsigned int id = 1; id < SlabAllocator::kMaxClasses; ++id) {
+        const List& list = lists[id];
+        std::lock_guard<std::mutex> lock(list.lock);
+        if(list.size == 0 && list.evicted == 0 && list.outOfMemory == 0) {
+            continue;
+        }
+        LruClassStat stat;
+        stat.id = id;
+        stat.number = list.size;
+        stat.age = list.tail != nullptr ? current - list.tail->getTime() : 0;
+        stat.evicted = list.evicted;
+        stat.evictedNonzero = list.evictedNonzero;
+        stat.reclaimed = list.reclaimed;
+        stat.outOfMemory = list.outOfMemory;
+        result.push_back(stat);
+    }
+
+    return result;
+}
@@ -0,0 +1,78 @@
+#ifndef MEMCACHED_LRU_H
+#define MEMCACHED_LRU_H
+
+#include "item.h"
+#include "slabs.h"
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+struct LruClassStat {
+    unsigned int id;
+    size_t number;
+    uint32_t age;          // tail item距离上次访问的秒数
+    uint64_t evicted;
+    uint64_t evictedNonzero;
+    uint64_t reclaimed;
+    uint64_t outOfMemory;
+};
+
+// 每个slab class一个LRU链表, head为最近访问的item.
+// 内存不足时从tail开始淘汰.
+class Lru {
+    public:
+        // 从hash表中删除victim(不释放引用), 获取不到对应shard的锁时返回false
+        typedef std::function<bool (Item* victim)> EvictCallback;
+        // item是否已经失效, 包括被flush_all
+        typedef std::function<bool (const Item* item)> ExpiredCallback;
+
+        Lru();
+
+        Lru(const Lru&) = delete;
+
+        Lru& operator=(const Lru&) = delete;
+
+        void link(Item* item);
+
+        void unlink(Item* item);
+
+        // 距离上次移动超过kUpdateInterval才移到head, 减少读路径上的锁竞争.
+        // 调用者不需要持有shard锁, 已经移出链表的item不做处理
+        void bump(Item* item);
+
+        // 从class clsid的tail开始尝试淘汰一个item.
+        // expired表示被淘汰的item是否已经失效, 由isExpired判断
+        bool evict(unsigned int clsid, const EvictCallback& cb, const ExpiredCallback& isExpired, bool* expired);
+
+        void addOutOfMemory(unsigned int clsid);
+
+        std::vector<LruClassStat> stats() const;
+
+        const static uint32_t kUpdateInterval = 60;
+
+    private:
+        // 淘汰时最多检查tail附近的item个数
+        const static int kSearchItems = 5;
+
+        struct List {
+            List() : head(nullptr), tail(nullptr), size(0), evicted(0), evictedNonzero(0),
+                reclaimed(0), outOfMemory(0) {}
+
+            Item* head;
+            Item* tail;
+            size_t size;
+            uint64_t evicted;
+            uint64_t evictedNonzero;
+            uint64_t reclaimed;
+            uint64_t outOfMemory;
+            mutable std::mutex lock;
+        };
+
+        void unlinkLocked(List& list, Item* item);
+        void linkLocked(List& list, Item* item);
+
+        List lists[SlabAllocator::kMaxClasses];
+};
+
+#endif
@@ -1,33 +1,306 @@
 #include "memcached.h"
+#include "relTime.h"
 #include "session.h"
+#include "snapshot.h"
+#include "util.h"
 
+#include "muduo/net/Channel.h"
 #include "muduo/net/EventLoop.h"
+#include "muduo/base/CountDownLatch.h"
 #include "muduo/base/Logging.h"
 
 #include <boost/bind.hpp>
 #include <boost/algorithm/string.hpp>
 
-Memcached::Memcached(muduo::net::EventLoop* loop, 
-        const muduo::net::InetAddress& listenAddr, int threadNum) 
-    : flush_time(0), listenAddr(listenAddr), casUnique(0), numThread(threadNum), server(loop, listenAddr, "Memcached"),
-      inspectorLoopThread(), inspector(inspectorLoopThread.startLoop(), muduo::net::InetAddress(11215), "memcached-stats") {
-        server.setConnectionCallback(boost::bind(&Memcached::onConnection, this, _1));
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+const double Memcached::kCrawlInterval = 0.1;
+const double Memcached::kHotKeysDecayInterval = 60.0;
+
+Memcached::Memcached(muduo::net::EventLoop* loop, const Options& options)
+    : casUnique(0), oldestCas(0), oldestLive(0), loop_(loop),
+      listenAddr(options.ip, options.port), numThread(options.threads),
+      reusePort(options.reusePort), pinThreads(options.pinThreads), nextCpu(0),
+      snapshotPath(options.snapshotPath), slabs_(options.maxBytes, options.factor),
+      inspectorLoopThread(), inspector(inspectorLoopThread.startLoop(), muduo::net::InetAddress(11215), "memcached-stats"),
+      crawlerLoopThread(), crawlerLoop(nullptr), crawlerShard(0) {
+        size_t slots = options.maxBytes / kShards / kBytesPerSlot;
+        for(int i = 0; i < kShards; ++i) {
+            shards[i].items.init(slots);
+        }
 
+        stats_.setMaxBytes(options.maxBytes);
         inspector.add("memcached", "stats", boost::bind(&MemcachedStat::report, &stats_), "statistics of memcached");
+        inspector.add("memcached", "slabs", boost::bind(&MemcachedStat::reportSlabs, &stats_, boost::cref(slabs_)),
+                "statistics of slab classes");
+        inspector.add("memcached", "items", boost::bind(&MemcachedStat::reportItems, &stats_, boost::cref(lru_)),
+                "statistics of items in each LRU");
+        inspector.add("memcached", "latency", boost::bind(&MemcachedStat::reportLatency, &stats_),
+                "latency percentiles of each command type");
+        if(options.hotKeys) {
+            hotKeys_.reset(new HotKeys());
+            inspector.add("memcached", "hotkeys", boost::bind(&HotKeys::reportJson, hotKeys_.get()),
+                    "sampled hottest keys in JSON");
+        }
+        if(options.slowMicros > 0) {
+            slowRequests_.reset(new SlowRequests(options.slowMicros));
+            inspector.add("memcached", "slow", boost::bind(&SlowRequests::reportJson, slowRequests_.get()),
+                    "recent slow requests in JSON");
+        }
+}
+
+// reusePort时TcpServer要在自己的loop线程中析构. 其余线程按成员的声明顺序在数据之前停止
+Memcached::~Memcached() {
+    for(size_t i = 0; i < acceptorThreads.size(); ++i) {
+        muduo::CountDownLatch latch(1);
+        muduo::net::TcpServer* server = servers[i].release();
+        server->getLoop()->runInLoop([server, &latch] {
+            delete server;
+            latch.countDown();
+        });
+        latch.wait();
+    }
 }
 
 void Memcached::start() {
-    server.setThreadNum(numThread);
-    server.start();
+    RelTime::start(loop_);
+    if(!snapshotPath.empty()) {
+        loadSnapshot();
+    }
+
+    muduo::net::TcpServer::ThreadInitCallback initCallback;
+    if(pinThreads) {
+        initCallback = boost::bind(&Memcached::pinThread, this, _1);
+    }
+    if(reusePort) {
+        // 每个线程的TcpServer只使用自己的loop, accept和读写都在同一个线程中
+        int acceptors = numThread > 0 ? numThread : 1;
+        for(int i = 0; i < acceptors; ++i) {
+            std::string name = "Memcached-" + std::to_string(i);
+            acceptorThreads.emplace_back(new muduo::net::EventLoopThread(initCallback, name));
+            muduo::net::EventLoop* ioLoop = acceptorThreads.back()->startLoop();
+            servers.emplace_back(new muduo::net::TcpServer(ioLoop, listenAddr, name,
+                        muduo::net::TcpServer::kReusePort));
+            // TcpServer::start要求在它自己的loop线程中调用
+            muduo::net::TcpServer* server = servers.back().get();
+            server->setConnectionCallback(boost::bind(&Memcached::onConnection, this, _1));
+            muduo::CountDownLatch latch(1);
+            ioLoop->runInLoop([server, &latch] {
+                server->start();
+                latch.countDown();
+            });
+            latch.wait();
+        }
+    }
+    else {
+        servers.emplace_back(new muduo::net::TcpServer(loop_, listenAddr, "Memcached"));
+        servers.back()->setThreadNum(numThread);
+        servers.back()->setThreadInitCallback(initCallback);
+        servers.back()->setConnectionCallback(boost::bind(&Memcached::onConnection, this, _1));
+        servers.back()->start();
+    }
+
+    crawlerLoop = crawlerLoopThread.startLoop();
+    crawlerLoop->runEvery(kCrawlInterval, boost::bind(&Memcached::crawl, this));
+    if(hotKeys_) {
+        crawlerLoop->runEvery(kHotKeysDecayInterval, boost::bind(&HotKeys::decay, hotKeys_.get()));
+    }
+}
+
+// 每个shard加锁时只收集item的引用, 写文件时不持有锁
+bool Memcached::saveSnapshot() {
+    if(snapshotPath.empty()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(snapshotMutex);
+    muduo::Timestamp start = muduo::Timestamp::now();
+    SnapshotWriter writer;
+    if(!writer.open(snapshotPath, kSnapshotSections)) {
+        LOG_SYSERR << "open snapshot " << snapshotPath << " failed";
+        return false;
+    }
+    const int shardsPerSection = kShards / kSnapshotSections;
+    uint32_t now = RelTime::now();
+    std::vector<ItemPtr> items;
+    size_t count = 0;
+    for(int i = 0; i < kShards; ++i) {
+        if(i % shardsPerSection == 0) {
+            writer.beginSection(i / shardsPerSection);
+        }
+        {
+            std::lock_guard<std::mutex> lock(shards[i].itemLock);
+            shards[i].items.forEach([this, now, &items](Item* item) {
+                if(!isExpired(item, now)) {
+                    items.push_back(ItemPtr(item));
+                }
+            });
+        }
+        for(const ItemPtr& item : items) {
+            char buf[kMaxUint64Length];
+            snapshot::Record record;
+            record.key = item->key();
+            record.value = item->value(buf);
+            record.flags = item->getFlags();
+            record.expireTime = item->getExpireTime() == 0 ? 0 : RelTime::toUnixTime(item->getExpireTime());
+            record.cas = item->getCas();
+            writer.append(record);
+        }
+        count += items.size();
+        items.clear();
+    }
+    if(!writer.commit()) {
+        LOG_SYSERR << "write snapshot " << snapshotPath << " failed";
+        return false;
+    }
+    LOG_INFO << "saved " << count << " items to " << snapshotPath << " in "
+             << muduo::timeDifference(muduo::Timestamp::now(), start) << "s";
+
+    return true;
+}
+
+void Memcached::saveSnapshotInBackground() {
+    crawlerLoop->runInLoop([this] { saveSnapshot(); });
+}
+
+void Memcached::loadSnapshot() {
+    SnapshotReader reader;
+    if(!reader.open(snapshotPath)) {
+        LOG_INFO << "no snapshot loaded from " << snapshotPath;
+        return;
+    }
+    muduo::Timestamp start = muduo::Timestamp::now();
+    time_t now = RelTime::toUnixTime(RelTime::now());
+    int numThreads = std::max(1, std::min(static_cast<int>(std::thread::hardware_concurrency()), reader.sections()));
+    std::atomic<size_t> loaded(0);
+    std::atomic<uint64_t> maxCas(0);
+    std::atomic<bool> corrupted(false);
+    std::vector<std::thread> loaders;
+    for(int t = 0; t < numThreads; ++t) {
+        loaders.emplace_back([&, t] {
+            size_t count = 0;
+            uint64_t localMaxCas = 0;
+            for(int section = t; section < reader.sections(); section += numThreads) {
+                bool complete = reader.forEach(section, [&](const snapshot::Record& record) {
+                    if(record.expireTime != 0 && record.expireTime <= now) {
+                        return;
+                    }
+                    uint32_t exptime = record.expireTime == 0 ? 0 : RelTime::fromUnixTime(record.expireTime);
+                    restoreItem(record.key, record.value, record.flags, exptime, record.cas);
+                    localMaxCas = std::max(localMaxCas, record.cas);
+                    ++count;
+                });
+                if(!complete) {
+                    corrupted = true;
+                }
+            }
+            loaded += count;
+            uint64_t cas = maxCas.load();
+            while(localMaxCas > cas && !maxCas.compare_exchange_weak(cas, localMaxCas)) {
+            }
+        });
+    }
+    for(std::thread& loader : loaders) {
+        loader.join();
+    }
+    // 之后分配的cas都大于快照中的cas
+    if(casUnique < maxCas) {
+        casUnique = maxCas.load();
+    }
+    if(corrupted) {
+        LOG_ERROR << "snapshot " << snapshotPath << " is truncated or corrupted";
+    }
+    LOG_INFO << "loaded " << loaded.load() << " items from " << snapshotPath << " in "
+             << muduo::timeDifference(muduo::Timestamp::now(), start) << "s";
+}
+
+void Memcached::restoreItem(const muduo::StringPiece& key, const muduo::StringPiece& value,
+        uint16_t flags, uint32_t exptime, uint64_t cas) {
+    if(key.empty() || !itemFits(key.size(), value.size())) {
+        return;
+    }
+    uint64_t hash = hashKey(key);
+    Item* item = allocItem(key, hash, value.size(), flags, exptime);
+    if(item == nullptr) {
+        return;
+    }
+    ::memcpy(item->valueData(), value.data(), value.size());
+    item->setCas(cas);
+
+    Shard& shard = shardOf(hash);
+    {
+        std::lock_guard<std::mutex> lock(shard.itemLock);
+        if(findLocked(shard, key, hash) == nullptr) {
+            linkItem(shard, item);
+            item = nullptr;
+        }
+    }
+    if(item != nullptr) {
+        item->decrRef();
+    }
+}
+
+// 每个shard只在扫描期间加锁, 不会长时间阻塞读写
+void Memcached::crawl() {
+    uint32_t now = RelTime::now();
+    for(int i = 0; i < kCrawlShards; ++i) {
+        Shard& shard = shards[crawlerShard];
+        crawlerShard = (crawlerShard + 1) % kShards;
+
+        std::lock_guard<std::mutex> lock(shard.itemLock);
+        shard.items.forEach([this, now](Item* item) {
+            if(isExpired(item, now)) {
+                crawlerExpired.push_back(item);
+            }
+        });
+        // 遍历时不能删除, 删除会修改链表
+        for(Item* item : crawlerExpired) {
+            unlinkItem(shard, item);
+
+            stats_.addCrawlerReclaimed();
+        }
+        crawlerExpired.clear();
+    }
+}
+
+void Memcached::pinThread(muduo::net::EventLoop*) {
+    long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+    int cpu = static_cast<int>(nextCpu++ % (cpus > 0 ? cpus : 1));
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+    if(err != 0) {
+        LOG_WARN << "pin IO thread to cpu " << cpu << " failed: " << strerror(err);
+    }
 }
 
+bool Memcached::isExpired(const Item* item, uint32_t now) const {
+    if(item->getExpireTime() != 0 && now >= item->getExpireTime()) {
+        return true;
+    }
+    uint32_t live = oldestLive.load(std::memory_order_relaxed);
+    if(live != 0 && live <= now && item->getTime() <= live) {
+        return true;
+    }
+
+    return item->getCas() < oldestCas.load(std::memory_order_relaxed);
+}
+
+// Session保存在连接的context中, 随连接一起销毁, 各个IO线程之间没有共享的表
 void Memcached::onConnection(const muduo::net::TcpConnectionPtr& conn) {
-    std::string name(conn->name().c_str());
     if(conn->connected()) {
-        LOG_INFO << name << " is UP.";
+        LOG_INFO << conn->name() << " is UP.";
         conn->setTcpNoDelay(true);
-        std::unique_ptr<Session> session(new Session(this, conn));
-        sessions[name] = std::move(session);
+        conn->setContext(std::shared_ptr<Session>(new Session(this, conn)));
 
         stats_.addCurrConnections(1);
         stats_.addTotalConnections();
@@ -35,199 +308,452 @@ void Memcached::onConnection(const muduo::net::TcpConnectionPtr& conn) {
     else {
         LOG_INFO << "inputBuffer size: " << conn->inputBuffer()->internalCapacity() 
                  << " outputBuffer size: " << conn->outputBuffer()->internalCapacity();
-        sessions.erase(name);
         stats_.addCurrConnections(-1);
     }
 }
 
-void Memcached::set(const std::string& key, const std::string& value, 
-        uint16_t flags, uint32_t exptime) {
-    ++casUnique;
-
-    uint32_t exp = convertExpireTime(exptime);
-    size_t index = hashFunc(key) % kShards; 
-    {
-        std::lock_guard<std::mutex> lock(shards[index].itemLock);
-        auto iter = shards[index].items.find(key);
-        if(iter != shards[index].items.end()) {
-            iter->second->set(value, flags, exp, casUnique);
+Item* Memcached::allocItem(const muduo::StringPiece& key, uint64_t hash, size_t nbytes, uint16_t flags,
+        uint32_t exptime, bool shardLocked) {
+    unsigned int clsid = slabs_.classId(Item::totalSize(key.size(), nbytes));
+    if(clsid == 0) {
+        return nullptr;
+    }
+    uint64_t cas = ++casUnique;
+    Item* item = Item::create(&slabs_, clsid, key, hash, nbytes, flags, exptime, cas);
+    int heldShard = shardLocked ? shardIndex(hash) : -1;
+    uint32_t now = RelTime::now();
+    for(int i = 0; item == nullptr && i < kEvictTries; ++i) {
+        bool expired = false;
+        if(!lru_.evict(clsid, boost::bind(&Memcached::unlinkVictim, this, _1, heldShard),
+                    boost::bind(&Memcached::isExpired, this, _1, now), &expired)) {
+            break;
+        }
+        if(expired) {
+            stats_.addReclaimed();
         }
         else {
-            std::shared_ptr<Item> item(new Item(key, value, flags, exp, casUnique));
-            shards[index].items[key] = item;
-
-            stats_.addTotalItems();
-            stats_.addCurrItems(1);
+            stats_.addEvictions();
         }
+        item = Item::create(&slabs_, clsid, key, hash, nbytes, flags, exptime, cas);
+    }
+    if(item == nullptr) {
+        lru_.addOutOfMemory(clsid);
     }
-}
 
-void Memcached::append(const std::string& key, const std::string& app) {
-    ++casUnique;
+    return item;
+}
 
-    size_t index = hashFunc(key) % kShards; 
-    {
-        std::lock_guard<std::mutex> lock(shards[index].itemLock);
-        auto itemPtr = (*shards[index].items.find(key)).second;
-        itemPtr->append(app, casUnique);
+// 调用者持有LRU的锁, 为了避免死锁只尝试获取shard的锁
+bool Memcached::unlinkVictim(Item* victim, int heldShard) {
+    uint64_t hash = victim->hash();
+    if(shardIndex(hash) == heldShard) {
+        return false;
+    }
+    Shard& shard = shardOf(hash);
+    std::unique_lock<std::mutex> lock(shard.itemLock, std::try_to_lock);
+    if(!lock.owns_lock()) {
+        return false;
+    }
+    if(shard.items.find(victim->key(), hash) != victim) {
+        return false;
     }
+    shard.items.remove(victim);
+
+    stats_.addCurrItems(-1);
+    stats_.addBytes(-static_cast<int64_t>(victim->totalSize()));
+    return true;
 }
 
-void Memcached::prepend(const std::string& key, const std::string& pre) {
-    ++casUnique;
+void Memcached::linkItem(Shard& shard, Item* item) {
+    shard.items.insert(item);
+    lru_.link(item);
 
-    size_t index = hashFunc(key) % kShards;
-    {
-        std::lock_guard<std::mutex> lock(shards[index].itemLock);
-        auto itemPtr = (*shards[index].items.find(key)).second;
-        itemPtr->prepend(pre, casUnique);
-    }
+    stats_.addTotalItems();
+    stats_.addCurrItems(1);
+    stats_.addBytes(static_cast<int64_t>(item->totalSize()));
 }
 
-std::shared_ptr<const Item> Memcached::get(const std::string& key) {
-    size_t index = hashFunc(key) % kShards;
-    {
-        std::lock_guard<std::mutex> lock(shards[index].itemLock);
-        auto iter = shards[index].items.find(key);
-        assert(iter != shards[index].items.end());
-        return (*iter).second;
-    }
+// 无锁读者可能还在访问item, 由引用计数保证在它们用完之前不会被释放
+void Memcached::unlinkItem(Shard& shard, Item* item) {
+    shard.items.remove(item);
+    lru_.unlink(item);
+
+    stats_.addCurrItems(-1);
+    stats_.addBytes(-static_cast<int64_t>(item->totalSize()));
+    item->decrRef();
 }
 
-std::map<std::string, std::shared_ptr<const Item>> Memcached::get(const std::vector<std::string>& keys) {
-    std::map<std::string, std::shared_ptr<const Item>> results;
-    for(auto key : keys) {
-        size_t index = hashFunc(key) % kShards;
-        {
-            std::lock_guard<std::mutex> lock(shards[index].itemLock);
-            auto iter = shards[index].items.find(key);
-            if(iter != shards[index].items.end()) {
-                if(iter->second->isExpire()) {
-                    shards[index].items.erase(iter);
-                    stats_.addCurrItems(-1);
-                }
-                else {
-                    results[key] = iter->second;
-                }
-            }
-        }
-    }
+void Memcached::replaceItem(Shard& shard, Item* old, Item* item) {
+    shard.items.replace(old, item);
+    lru_.unlink(old);
+    lru_.link(item);
 
-    return results;
+    stats_.addBytes(static_cast<int64_t>(item->totalSize()) - static_cast<int64_t>(old->totalSize()));
+    old->decrRef();
 }
 
-void Memcached::deleteKey(const std::string& key) {
-    size_t index = hashFunc(key) % kShards;
-    {
-        std::lock_guard<std::mutex> lock(shards[index].itemLock);
-        shards[index].items.erase(key);
+bool Memcached::itemFits(size_t nkey, size_t nbytes) const {
+    return slabs_.classId(Item::totalSize(nkey, nbytes)) != 0;
+}
+
+Item* Memcached::findLocked(Shard& shard, const muduo::StringPiece& key, uint64_t hash) {
+    Item* item = shard.items.find(key, hash);
+    if(item != nullptr && isExpired(item, RelTime::now())) {
+        unlinkItem(shard, item);
+        return nullptr;
     }
-    stats_.addCurrItems(-1);
+
+    return item;
 }
 
-uint64_t Memcached::incr(const std::string& key, uint64_t increment) {
-    ++casUnique;
-    size_t index = hashFunc(key) % kShards;
+Memcached::Status Memcached::store(StoreMode mode, const muduo::StringPiece& key,
+        const muduo::StringPiece& value, uint16_t flags, uint32_t exptime,
+        uint64_t expectedCas, uint64_t* cas) {
+    bool concat = mode == kAppend || mode == kPrepend;
+    // 大小已知时在加锁之前分配, 淘汰时不会碰到自己持有的shard锁
+    uint64_t hash = hashKey(key);
+    if(hotKeys_) {
+        hotKeys_->sample(key, hash);
+    }
+    Item* item = nullptr;
+    if(!concat) {
+        item = allocItem(key, hash, value.size(), flags, exptime);
+        if(item == nullptr) {
+            return kOutOfMemory;
+        }
+        ::memcpy(item->valueData(), value.data(), value.size());
+    }
+
+    Shard& shard = shardOf(hash);
+    Status status = kOk;
     {
-        std::lock_guard<std::mutex> lock(shards[index].itemLock);
-        auto iter = shards[index].items.find(key);
-        assert(iter != shards[index].items.end());
-        uint64_t result = iter->second->incr(increment, casUnique);
+        std::lock_guard<std::mutex> lock(shard.itemLock);
+        Item* old = findLocked(shard, key, hash);
+        if(expectedCas != 0 && old == nullptr) {
+            status = kNotFound;
+        }
+        else if(expectedCas != 0 && old->getCas() != expectedCas) {
+            status = kExists;
+        }
+        else if(mode == kAdd && old != nullptr) {
+            status = kNotStored;
+        }
+        else if((mode == kReplace || concat) && old == nullptr) {
+            status = kNotStored;
+        }
+        else if(concat) {
+            char buf[kMaxUint64Length];
+            muduo::StringPiece oldValue = old->value(buf);
+            item = allocItem(key, hash, oldValue.size() + value.size(), old->getFlags(),
+                    old->getExpireTime(), true);
+            if(item == nullptr) {
+                status = kOutOfMemory;
+            }
+            else if(mode == kAppend) {
+                ::memcpy(item->valueData(), oldValue.data(), oldValue.size());
+                ::memcpy(item->valueData() + oldValue.size(), value.data(), value.size());
+            }
+            else {
+                ::memcpy(item->valueData(), value.data(), value.size());
+                ::memcpy(item->valueData() + value.size(), oldValue.data(), oldValue.size());
+            }
+        }
 
-        return result;
+        if(status == kOk) {
+            if(old != nullptr) {
+                replaceItem(shard, old, item);
+            }
+            else {
+                linkItem(shard, item);
+            }
+            if(cas != nullptr) {
+                *cas = item->getCas();
+            }
+        }
+    }
+    // 没有写入的item还给slab
+    if(status != kOk && item != nullptr) {
+        item->decrRef();
     }
+
+    return status;
 }
 
-uint64_t Memcached::decr(const std::string& key, uint64_t decrement) {
-    ++casUnique;
-    size_t index = hashFunc(key) % kShards;
-    {
-        std::lock_guard<std::mutex> lock(shards[index].itemLock);
-        auto iter = shards[index].items.find(key);
-        assert(iter != shards[index].items.end());
-        uint64_t result = iter->second->decr(decrement, casUnique);
-        return result;
+// 过期的item只在这里加锁删除, 命中和未命中都不加锁
+ItemPtr Memcached::lookup(const muduo::StringPiece& key, uint64_t hash) {
+    if(hotKeys_) {
+        hotKeys_->sample(key, hash);
+    }
+    Shard& shard = shardOf(hash);
+    Item* item = nullptr;
+    bool acquired = false;
+    for(int i = 0; i < kReadRetries && !acquired; ++i) {
+        acquired = shard.items.tryAcquire(key, hash, &item);
     }
+    if(!acquired) {
+        std::lock_guard<std::mutex> lock(shard.itemLock);
+        item = shard.items.find(key, hash);
+        if(item != nullptr) {
+            item->incrRef();
+        }
+    }
+    if(item == nullptr) {
+        return ItemPtr();
+    }
+    // 接管tryAcquire/incrRef增加的引用
+    ItemPtr result(item, false);
+    if(isExpired(item, RelTime::now())) {
+        std::lock_guard<std::mutex> lock(shard.itemLock);
+        if(shard.items.find(key, hash) == item) {
+            unlinkItem(shard, item);
+        }
+        return ItemPtr();
+    }
+    lru_.bump(item);
+
+    return result;
 }
 
-void Memcached::touch(const std::string& key, uint32_t exptime) {
-    uint32_t exp = convertExpireTime(exptime);
-    size_t index = hashFunc(key) % kShards;
-    {
-        std::lock_guard<std::mutex> lock(shards[index].itemLock);
-        auto iter = shards[index].items.find(key);
-        assert(iter != shards[index].items.end());
-        iter->second->touch(exp);
-    }
+ItemPtr Memcached::get(const muduo::StringPiece& key) {
+    return lookup(key, hashKey(key));
 }
 
-void Memcached::flush_all(uint32_t exptime) {
-    flush_time = exptime;
-    uint32_t t = static_cast<uint32_t>(muduo::Timestamp::now().secondsSinceEpoch()) - 1;
-    if(exptime != 0) {
-        t = exptime;
+// 每批先计算hash并预取所有bucket, 再依次查找, cache miss不再逐个串行等待
+void Memcached::get(KeyList::const_iterator begin, KeyList::const_iterator end,
+        std::vector<ItemPtr>* items) {
+    uint64_t hashes[kGetBatch];
+    while(begin != end) {
+        int n = 0;
+        for(auto keyIter = begin; keyIter != end && n < kGetBatch; ++keyIter, ++n) {
+            hashes[n] = hashKey(*keyIter);
+            shardOf(hashes[n]).items.prefetch(hashes[n]);
+        }
+        for(int i = 0; i < n; ++i, ++begin) {
+            items->push_back(lookup(*begin, hashes[i]));
+        }
     }
-    for(int i = 0; i < kShards; ++i) {
-        std::lock_guard<std::mutex> lock(shards[i].itemLock);
-        for(auto& item : shards[i].items) {
-            item.second->touch(t);
+}
+
+Memcached::Status Memcached::deleteKey(const muduo::StringPiece& key, uint64_t expectedCas) {
+    uint64_t hash = hashKey(key);
+    Shard& shard = shardOf(hash);
+    {
+        std::lock_guard<std::mutex> lock(shard.itemLock);
+        Item* item = findLocked(shard, key, hash);
+        if(item == nullptr) {
+            return kNotFound;
         }
+        if(expectedCas != 0 && item->getCas() != expectedCas) {
+            return kExists;
+        }
+        unlinkItem(shard, item);
     }
+
+    return kOk;
 }
 
-bool Memcached::exists(const std::string& key) {
-    size_t index = hashFunc(key) % kShards;
+// 第一次incr/decr时把文本转换成数字保存在新的item中, 之后直接原地修改, 不再分配内存
+Memcached::Status Memcached::storeNumber(const muduo::StringPiece& key, uint64_t delta, bool incr,
+        uint64_t* result, uint64_t expectedCas, uint64_t* cas) {
+    uint64_t hash = hashKey(key);
+    if(hotKeys_) {
+        hotKeys_->sample(key, hash);
+    }
+    Shard& shard = shardOf(hash);
     {
-        std::lock_guard<std::mutex> lock(shards[index].itemLock);
-        auto iter = shards[index].items.find(key);
-        if(iter == shards[index].items.end()) {
-            return false;
+        std::lock_guard<std::mutex> lock(shard.itemLock);
+        Item* old = findLocked(shard, key, hash);
+        if(old == nullptr) {
+            return kNotFound;
+        }
+        if(expectedCas != 0 && old->getCas() != expectedCas) {
+            return kExists;
+        }
+        uint64_t value = 0;
+        if(old->isNumber()) {
+            value = old->getNumber();
+        }
+        else if(!toUint(old->value(), &value)) {
+            return kNonNumeric;
+        }
+        if(incr) {
+            value += delta; // 相加后溢出(回绕)
         }
         else {
-            bool expired = iter->second->isExpire();
-            if(expired) {
-                shards[index].items.erase(iter);
-                stats_.addCurrItems(-1);
+            value = delta < value ? value - delta : 0;
+        }
+
+        Item* item = old;
+        if(old->isNumber()) {
+            old->setNumber(value, ++casUnique);
+        }
+        else {
+            item = allocItem(key, hash, Item::kNumberBytes, old->getFlags(),
+                    old->getExpireTime(), true);
+            if(item == nullptr) {
+                return kOutOfMemory;
             }
-            return !expired;
+            item->initNumber(value);
+            replaceItem(shard, old, item);
+        }
+        *result = value;
+        if(cas != nullptr) {
+            *cas = item->getCas();
         }
     }
+
+    return kOk;
 }
 
-MemcachedStat& Memcached::memStats() {
-    return stats_;    
+Memcached::Status Memcached::incr(const muduo::StringPiece& key, uint64_t increment, uint64_t* result,
+        uint64_t expectedCas, uint64_t* cas) {
+    return storeNumber(key, increment, true, result, expectedCas, cas);
+}
+
+Memcached::Status Memcached::decr(const muduo::StringPiece& key, uint64_t decrement, uint64_t* result,
+        uint64_t expectedCas, uint64_t* cas) {
+    return storeNumber(key, decrement, false, result, expectedCas, cas);
 }
 
-uint32_t Memcached::convertExpireTime(uint32_t time) {
-    uint32_t exp = time;
-    uint32_t now = static_cast<uint32_t>(muduo::Timestamp::now().secondsSinceEpoch());
-    if(flush_time >= now && (time > flush_time || time == 0)) {
-        exp = flush_time;
+ItemPtr Memcached::touch(const muduo::StringPiece& key, uint32_t exptime) {
+    uint64_t hash = hashKey(key);
+    Shard& shard = shardOf(hash);
+    {
+        std::lock_guard<std::mutex> lock(shard.itemLock);
+        Item* item = findLocked(shard, key, hash);
+        if(item == nullptr) {
+            return ItemPtr();
+        }
+        item->touch(exptime);
+        return ItemPtr(item);
     }
+}
 
-    return exp;
+void Memcached::flush_all(uint32_t exptime) {
+    if(exptime == 0) {
+        oldestLive.store(0);
+        oldestCas.store(casUnique.load() + 1);
+    }
+    else {
+        oldestLive.store(exptime);
+    }
+}
+
+bool Memcached::exists(const muduo::StringPiece& key) {
+    return lookup(key, hashKey(key)) != nullptr;
+}
+
+MemcachedStat& Memcached::memStats() {
+    return stats_;    
 }
 
 
 
+void usage(const char* name) {
+    std::cout << "Usage: " << name << " [options]\n"
+              << "-l <addr>     interface to listen on (default: 127.0.0.1)\n"
+              << "-p <num>      TCP port number to listen on (default: 11211)\n"
+              << "-t <num>      number of IO threads to use (default: 1)\n"
+              << "-m <num>      item memory in megabytes (default: 64)\n"
+              << "-f <factor>   chunk size growth factor (default: 1.25)\n"
+              << "-R            every IO thread accepts on its own SO_REUSEPORT socket\n"
+              << "-a            pin IO threads to CPUs\n"
+              << "-s <file>     snapshot file, loaded at startup, saved on SIGUSR1 and at exit\n"
+              << "-k            sample hot keys, reported by the inspector\n"
+              << "-S <us>       log requests slower than <us> microseconds\n"
+              << "-h            print this help and exit\n";
+}
+
 int main(int argc, char** argv) {
-    std::string defaultIP = "127.0.0.1";
-    uint16_t defaultPort = 11211;
-    if(argc >= 3) {
-        defaultIP = std::string(argv[1]);
-        defaultPort = static_cast<uint16_t>(atoi(argv[2]));
-    }
-    int threadNum = 1;
-    if(argc >= 4) {
-        threadNum = atoi(argv[3]);
+    Memcached::Options options;
+    int opt;
+    while((opt = getopt(argc, argv, "l:p:t:m:f:Ras:kS:h")) != -1) {
+        switch(opt) {
+            case 'l':
+                options.ip = optarg;
+                break;
+            case 'p':
+                options.port = static_cast<uint16_t>(atoi(optarg));
+                break;
+            case 't':
+                options.threads = atoi(optarg);
+                break;
+            case 'm':
+                options.maxBytes = static_cast<size_t>(atol(optarg)) * 1024 * 1024;
+                break;
+            case 'f':
+                options.factor = atof(optarg);
+                if(options.factor <= 1.0) {
+                    std::cerr << "Factor must be greater than 1\n";
+                    return 1;
+                }
+                break;
+            case 'R':
+                options.reusePort = true;
+                break;
+            case 'a':
+                options.pinThreads = true;
+                break;
+            case 's':
+                options.snapshotPath = optarg;
+                break;
+            case 'k':
+                options.hotKeys = true;
+                break;
+            case 'S':
+                options.slowMicros = atol(optarg);
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
     }
     
-    muduo::net::InetAddress listenAddr(defaultIP, defaultPort);
+    // 使用快照时在创建其他线程之前屏蔽信号, 由主线程通过signalfd处理:
+    // SIGUSR1在后台写快照, SIGTERM/SIGINT写快照后退出
+    sigset_t signals;
+    ::sigemptyset(&signals);
+    ::sigaddset(&signals, SIGUSR1);
+    ::sigaddset(&signals, SIGTERM);
+    ::sigaddset(&signals, SIGINT);
+    int signalFd = -1;
+    if(!options.snapshotPath.empty()) {
+        ::pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        signalFd = ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    }
+
     muduo::net::EventLoop loop;
-    Memcached server(&loop, listenAddr, threadNum);    
+    Memcached server(&loop, options);    
     server.start();
 
+    std::unique_ptr<muduo::net::Channel> signalChannel;
+    if(signalFd >= 0) {
+        signalChannel.reset(new muduo::net::Channel(&loop, signalFd));
+        signalChannel->setReadCallback([&](muduo::Timestamp) {
+            struct signalfd_siginfo info;
+            while(::read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+                if(info.ssi_signo == SIGUSR1) {
+                    server.saveSnapshotInBackground();
+                }
+                else {
+                    server.saveSnapshot();
+                    loop.quit();
+                }
+            }
+        });
+        signalChannel->enableReading();
+    }
+
     loop.loop();
 
+    if(signalChannel) {
+        signalChannel->disableAll();
+        signalChannel->remove();
+        ::close(signalFd);
+    }
+
     return 0;
 }
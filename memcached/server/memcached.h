@@ -8,68 +8,246 @@
 #include "muduo/net/InetAddress.h"
 
 #include "item.h"
+#include "itemTable.h"
+#include "keyHash.h"
+#include "lru.h"
+#include "sampler.h"
+#include "slabs.h"
 #include "stat.h"
 
 #include <atomic>
-#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 class Session;
 
 class Memcached {
     public:
-        Memcached(muduo::net::EventLoop* loop, const muduo::net::InetAddress& listenAddr, int threadNum);
-
+        struct Options {
+            Options() : ip("127.0.0.1"), port(11211), threads(1),
+                maxBytes(64 * 1024 * 1024), factor(1.25), reusePort(false), pinThreads(false),
+                hotKeys(false), slowMicros(0) {}
+
+            std::string ip;
+            uint16_t port;
+            int threads;
+            size_t maxBytes;
+            double factor;
+            // 每个IO线程用SO_REUSEPORT各自监听端口, 由内核分配连接, 而不是一个线程accept后轮流分配
+            bool reusePort;
+            // IO线程依次绑定到各个CPU上
+            bool pinThreads;
+            // 快照文件, 为空时不使用快照. 启动时从快照加载, 退出时写入快照
+            std::string snapshotPath;
+            // 采样统计热点key
+            bool hotKeys;
+            // 一次读事件的处理时间超过slowMicros微秒时记录为慢请求, 0表示不记录
+            int64_t slowMicros;
+        };
+
+        // multiget的key列表, 指向调用者的buffer
+        typedef std::vector<muduo::StringPiece> KeyList;
+
+        Memcached(muduo::net::EventLoop* loop, const Options& options);
+
+        ~Memcached();
+
+        // 先从快照加载(如果有), 再开始监听
         void start();
 
-        void set(const std::string& key, const std::string& value, uint16_t flags, uint32_t exptime);
-       
-        void append(const std::string& key, const std::string& app);
+        // 把所有未过期的item写入快照文件, 可以在任意线程中调用, 同一时间只有一个快照在写
+        bool saveSnapshot();
+
+        // 在crawler线程中写快照, 不阻塞调用者
+        void saveSnapshotInBackground();
+
+        // 写操作的结果, 每个操作只查找一次hash表, 检查和修改在同一次加锁中完成
+        enum Status {
+            kOk,          // 写入/删除/修改成功
+            kNotStored,   // add时key已存在
+            kExists,      // cas不匹配
+            kNotFound,    // key不存在或已过期
+            kNonNumeric,  // incr/decr的值不是数字
+            kOutOfMemory
+        };
+
+        enum StoreMode { kSet, kAdd, kReplace, kAppend, kPrepend };
+
+        // expectedCas不为0时只有当前item的cas与之相等才写入.
+        // 成功时cas不为空则写入新item的cas. append/prepend忽略flags和exptime
+        Status store(StoreMode mode, const muduo::StringPiece& key, const muduo::StringPiece& value,
+                uint16_t flags, uint32_t exptime, uint64_t expectedCas = 0, uint64_t* cas = nullptr);
+
+        // 内存不足时返回false
+        bool set(const muduo::StringPiece& key, const muduo::StringPiece& value, uint16_t flags,
+                uint32_t exptime, uint64_t* cas = nullptr) {
+            return store(kSet, key, value, flags, exptime, 0, cas) == kOk;
+        }
+
+        Status add(const muduo::StringPiece& key, const muduo::StringPiece& value, uint16_t flags,
+                uint32_t exptime, uint64_t* cas = nullptr) {
+            return store(kAdd, key, value, flags, exptime, 0, cas);
+        }
+
+        Status replace(const muduo::StringPiece& key, const muduo::StringPiece& value, uint16_t flags,
+                uint32_t exptime, uint64_t* cas = nullptr) {
+            return store(kReplace, key, value, flags, exptime, 0, cas);
+        }
+
+        Status casStore(const muduo::StringPiece& key, const muduo::StringPiece& value, uint16_t flags,
+                uint32_t exptime, uint64_t expectedCas, uint64_t* cas = nullptr) {
+            return store(kSet, key, value, flags, exptime, expectedCas, cas);
+        }
+
+        Status appendIfExists(const muduo::StringPiece& key, const muduo::StringPiece& app,
+                uint64_t* cas = nullptr) {
+            return store(kAppend, key, app, 0, 0, 0, cas);
+        }
+
+        Status prependIfExists(const muduo::StringPiece& key, const muduo::StringPiece& pre,
+                uint64_t* cas = nullptr) {
+            return store(kPrepend, key, pre, 0, 0, 0, cas);
+        }
+
+        // key不存在或已过期时返回空指针. 查找不加锁
+        ItemPtr get(const muduo::StringPiece& key);
+
+        // 结果按key的顺序追加到items中, 不存在的key对应空指针
+        void get(KeyList::const_iterator begin, KeyList::const_iterator end, std::vector<ItemPtr>* items);
+
+        // 返回kOk, kNotFound或kExists
+        Status deleteKey(const muduo::StringPiece& key, uint64_t expectedCas = 0);
+
+        // 成功时result为新的值
+        Status incr(const muduo::StringPiece& key, uint64_t value, uint64_t* result,
+                uint64_t expectedCas = 0, uint64_t* cas = nullptr);
+
+        Status decr(const muduo::StringPiece& key, uint64_t value, uint64_t* result,
+                uint64_t expectedCas = 0, uint64_t* cas = nullptr);
+
+        // 返回修改后的item, key不存在时返回空指针
+        ItemPtr touch(const muduo::StringPiece& key, uint32_t exptime);
+
+        // exptime为0时立即使所有item失效, 否则在exptime时刻使当时存在的item失效.
+        // 只记录失效条件, item在被访问或被crawler扫描到时才删除
+        void flush_all(uint32_t exptime = 0);
 
-        void prepend(const std::string& key, const std::string& pre);
+        void stats();
 
-        std::shared_ptr<const Item> get(const std::string& key);
+        bool exists(const muduo::StringPiece& key);
 
-        std::map<std::string, std::shared_ptr<const Item>> get(const std::vector<std::string>& keys);
+        // key和value能否放入一个slab chunk
+        bool itemFits(size_t nkey, size_t nbytes) const;
 
-        void deleteKey(const std::string& key);
+        MemcachedStat& memStats();
 
-        uint64_t incr(const std::string& key, uint64_t value);
+        const SlabAllocator& slabs() const { return slabs_; }
 
-        uint64_t decr(const std::string& key, uint64_t value);
+        const Lru& lru() const { return lru_; }
 
-        void touch(const std::string& key, uint32_t exptime);
+        // 没有开启时为nullptr
+        SlowRequests* slowRequests() { return slowRequests_.get(); }
 
-        void flush_all(uint32_t exptime = 0);
+    private:
+        // 写操作持有itemLock, 读操作不加锁
+        struct Shard {
+            std::mutex itemLock;
+            ItemTable items;
+        };
 
-        void stats();
+        // hashKey()的高kShardBits位选择shard, 低位由ItemTable选择bucket
+        static int shardIndex(uint64_t hash) { return static_cast<int>(hash >> (64 - kShardBits)); }
+        Shard& shardOf(uint64_t hash) { return shards[shardIndex(hash)]; }
 
-        bool exists(const std::string& key);
+        void onConnection(const muduo::net::TcpConnectionPtr& conn);
 
-        uint32_t convertExpireTime(uint32_t t);
+        // IO线程的初始化回调, 绑定到下一个CPU
+        void pinThread(muduo::net::EventLoop* loop);
 
-        MemcachedStat& memStats();
+        // 分配item, 内存不足时从LRU中淘汰; shardLocked表示调用者已经持有key所在shard的锁
+        Item* allocItem(const muduo::StringPiece& key, uint64_t hash, size_t nbytes, uint16_t flags,
+                uint32_t exptime, bool shardLocked = false);
 
-    private:
-        void onConnection(const muduo::net::TcpConnectionPtr& conn);
+        // Lru::evict的回调, 从hash表中删除victim
+        bool unlinkVictim(Item* victim, int heldShard);
+
+        // item已过期或者已被flush_all
+        bool isExpired(const Item* item, uint32_t now) const;
+
+        // 在crawler线程中定期执行, 每次扫描kCrawlShards个shard, 删除过期的item
+        void crawl();
+
+        // 多个线程并行加载快照, 跳过已过期的item
+        void loadSnapshot();
+
+        // 加入快照中的item, 保留原来的cas; key已经存在时忽略
+        void restoreItem(const muduo::StringPiece& key, const muduo::StringPiece& value,
+                uint16_t flags, uint32_t exptime, uint64_t cas);
+
+        // 查找未过期的item, 先不加锁查找, 多次遇到并发修改时才加锁
+        ItemPtr lookup(const muduo::StringPiece& key, uint64_t hash);
+
+        // 以下函数需要持有对应shard的锁
+        // 查找未过期的item, 过期的item会被删除
+        Item* findLocked(Shard& shard, const muduo::StringPiece& key, uint64_t hash);
+        void linkItem(Shard& shard, Item* item);
+        void unlinkItem(Shard& shard, Item* item);
+        void replaceItem(Shard& shard, Item* old, Item* item);
+
+        Status storeNumber(const muduo::StringPiece& key, uint64_t delta, bool incr,
+                uint64_t* result, uint64_t expectedCas, uint64_t* cas);
 
-        uint32_t flush_time;
-        muduo::net::InetAddress listenAddr;
         std::atomic<uint64_t> casUnique;
+        // 立即flush: cas小于oldestCas的item失效
+        std::atomic<uint64_t> oldestCas;
+        // 延迟flush: 到达oldestLive之后, 最近访问时间不晚于oldestLive的item失效. 0表示没有
+        std::atomic<uint32_t> oldestLive;
+        muduo::net::EventLoop* loop_;
+        muduo::net::InetAddress listenAddr;
         int numThread;
-        muduo::net::TcpServer server;
-
-        muduo::net::EventLoopThread inspectorLoopThread;
-        muduo::net::Inspector inspector; 
+        bool reusePort;
+        bool pinThreads;
+        std::atomic<int> nextCpu;
+        std::string snapshotPath;
+        std::mutex snapshotMutex;
+        std::unique_ptr<HotKeys> hotKeys_;
+        std::unique_ptr<SlowRequests> slowRequests_;
         MemcachedStat stats_;
+        SlabAllocator slabs_;
+        Lru lru_;
+
+        const static int kShardBits = 12;
+        const static int kShards = 1 << kShardBits;
+        // 每个slot对应的内存大小, 用来根据内存上限确定hash表的初始大小, 之后按需增长
+        const static size_t kBytesPerSlot = 512;
+        // 无锁查找遇到并发修改时的重试次数
+        const static int kReadRetries = 3;
+        // crawler的执行间隔(秒)和每次扫描的shard数, 大约每6秒扫描一遍所有的shard
+        const static double kCrawlInterval;
+        const static int kCrawlShards = 64;
+        // 分配失败时最多淘汰的次数
+        const static int kEvictTries = 10;
+        // multiget每批计算hash并预取的key数
+        const static int kGetBatch = 32;
+        // 快照的section数, 每个section包含kShards / kSnapshotSections个shard
+        const static int kSnapshotSections = 64;
+        // 热点key的计数每隔多少秒减半
+        const static double kHotKeysDecayInterval;
+        Shard shards[kShards];
+
+        // 以下成员拥有会访问上面数据的线程, 放在最后使它们先析构:
+        // crawler, inspector和IO线程都停止之后才销毁shards, lru_和slabs_
+        // reusePort时每个IO线程一个TcpServer, 否则只有一个运行在loop_中的TcpServer
+        std::vector<std::unique_ptr<muduo::net::EventLoopThread>> acceptorThreads;
+        std::vector<std::unique_ptr<muduo::net::TcpServer>> servers;
 
-        std::unordered_map<std::string, std::unique_ptr<Session>> sessions;
-
-        std::hash<std::string> hashFunc;
-        const static int kShards = 4096;
-        struct ItemsWithLock {
-            std::mutex itemLock;
-            std::unordered_map<std::string, std::shared_ptr<Item>> items;
-        } shards[kShards];
+        muduo::net::EventLoopThread inspectorLoopThread;
+        muduo::net::Inspector inspector;
+        muduo::net::EventLoopThread crawlerLoopThread;
+        muduo::net::EventLoop* crawlerLoop;
+        int crawlerShard; // 下一次crawl开始的shard, 只在crawler线程中访问
+        std::vector<Item*> crawlerExpired;
 };
 
 #endif
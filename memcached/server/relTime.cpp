@@ -0,0 +1,26 @@
+#include "relTime.h"
+
+#include "muduo/base/Timestamp.h"
+#include "muduo/net/EventLoop.h"
+
+time_t RelTime::startTime = 0;
+std::atomic<uint32_t> RelTime::current(0);
+
+namespace {
+
+time_t unixTime() {
+    return muduo::Timestamp::now().secondsSinceEpoch();
+}
+
+}
+
+// 和memcached一样把起点往前推一点, 保证相对时间不为0
+void RelTime::start(muduo::net::EventLoop* loop) {
+    startTime = unixTime() - 2;
+    update();
+    loop->runEvery(1.0, &RelTime::update);
+}
+
+void RelTime::update() {
+    current.store(static_cast<uint32_t>(unixTime() - startTime), std::memory_order_relaxed);
+}
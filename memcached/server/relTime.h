@@ -0,0 +1,39 @@
+#ifndef MEMCACHED_REL_TIME_H
+#define MEMCACHED_REL_TIME_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+
+namespace muduo {
+namespace net {
+class EventLoop;
+}
+}
+
+// 进程内使用的粗粒度时钟: 以进程启动时间为起点的秒数(即memcached的rel_time).
+// 由EventLoop上的定时器每秒更新一次, 读取只是一次原子load, 不需要系统调用.
+// item的访问时间和过期时间都使用这个时间, 0表示永不过期
+class RelTime {
+    public:
+        // 在loop所在线程中调用一次, 之后每秒更新当前时间
+        static void start(muduo::net::EventLoop* loop);
+
+        static uint32_t now() { return current.load(std::memory_order_relaxed); }
+
+        // unix时间戳转换为相对时间, 早于进程启动的时间转换为1(已经过期)
+        static uint32_t fromUnixTime(time_t t) {
+            return t > startTime ? static_cast<uint32_t>(t - startTime) : 1;
+        }
+
+        static time_t toUnixTime(uint32_t t) { return startTime + t; }
+
+    private:
+        static void update();
+
+        static time_t startTime;
+        static std::atomic<uint32_t> current;
+};
+
+#endif
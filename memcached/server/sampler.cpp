@@ -0,0 +1,138 @@
+#include "sampler.h"
+
+#include "muduo/base/Logging.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sstream>
+
+namespace {
+
+// key可以包含任意字节(二进制协议), 控制字符和非ASCII字节用\u00XX表示
+void appendJsonString(std::ostream& out, const std::string& s) {
+    out << '"';
+    for(unsigned char c : s) {
+        if(c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if(c < 0x20 || c >= 0x7f) {
+            char buf[8];
+            ::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out << buf;
+        }
+        else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+}
+
+HotKeys::HotKeys() : sketch(new std::atomic<uint32_t>[kDepth * kWidth]), minTopCount(0) {
+    for(uint32_t i = 0; i < kDepth * kWidth; ++i) {
+        sketch[i].store(0, std::memory_order_relaxed);
+    }
+    top.reserve(kTopK);
+}
+
+void HotKeys::update(const muduo::StringPiece& key, uint32_t estimate) {
+    auto heapOrder = [](const Entry& a, const Entry& b) { return a.count > b.count; };
+    std::lock_guard<std::mutex> lock(mutex);
+    for(Entry& entry : top) {
+        if(entry.key.size() == static_cast<size_t>(key.size())
+                && ::memcmp(entry.key.data(), key.data(), key.size()) == 0) {
+            entry.count = std::max(entry.count, estimate);
+            std::make_heap(top.begin(), top.end(), heapOrder);
+            updateMinTopCount();
+            return;
+        }
+    }
+    if(top.size() < kTopK) {
+        top.push_back(Entry());
+    }
+    else if(estimate > top.front().count) {
+        std::pop_heap(top.begin(), top.end(), heapOrder);
+    }
+    else {
+        return;
+    }
+    key.CopyToStdString(&top.back().key);
+    top.back().count = estimate;
+    std::push_heap(top.begin(), top.end(), heapOrder);
+    updateMinTopCount();
+}
+
+void HotKeys::updateMinTopCount() {
+    minTopCount.store(top.size() < kTopK ? 0 : top.front().count, std::memory_order_relaxed);
+}
+
+// 和sample并发执行时可能丢失少量计数, 对统计没有影响
+void HotKeys::decay() {
+    for(uint32_t i = 0; i < kDepth * kWidth; ++i) {
+        sketch[i].store(sketch[i].load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for(Entry& entry : top) {
+        entry.count /= 2;
+    }
+    updateMinTopCount();
+}
+
+muduo::string HotKeys::reportJson() const {
+    std::vector<Entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries = top;
+    }
+    std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) { return a.count > b.count; });
+    std::ostringstream out;
+    out << "{\"sample_rate\":" << kSampleRate << ",\"keys\":[";
+    for(size_t i = 0; i < entries.size(); ++i) {
+        out << (i == 0 ? "" : ",") << "{\"key\":";
+        appendJsonString(out, entries[i].key);
+        out << ",\"count\":" << static_cast<uint64_t>(entries[i].count) * kSampleRate << "}";
+    }
+    out << "]}\n";
+
+    return muduo::string(out.str().c_str());
+}
+
+SlowRequests::SlowRequests(int64_t threshold) : thresholdMicros(threshold), total(0) {
+}
+
+void SlowRequests::add(const std::string& peer, const std::string& key, int commands, int64_t micros) {
+    LOG_WARN << "slow request from " << peer << ": " << commands << " commands, first key "
+             << key << ", " << micros << "us";
+    Entry entry;
+    entry.time = muduo::Timestamp::now();
+    entry.peer = peer;
+    entry.key = key;
+    entry.commands = commands;
+    entry.micros = micros;
+    std::lock_guard<std::mutex> lock(mutex);
+    if(entries.size() == kMaxEntries) {
+        entries.pop_front();
+    }
+    entries.push_back(std::move(entry));
+    ++total;
+}
+
+muduo::string SlowRequests::reportJson() const {
+    std::ostringstream out;
+    std::lock_guard<std::mutex> lock(mutex);
+    out << "{\"threshold_us\":" << thresholdMicros << ",\"total\":" << total << ",\"requests\":[";
+    for(size_t i = 0; i < entries.size(); ++i) {
+        const Entry& entry = entries[i];
+        out << (i == 0 ? "" : ",") << "{\"time\":\"" << entry.time.toFormattedString() << "\",\"peer\":";
+        appendJsonString(out, entry.peer);
+        out << ",\"key\":";
+        appendJsonString(out, entry.key);
+        out << ",\"commands\":" << entry.commands << ",\"latency_us\":" << entry.micros << "}";
+    }
+    out << "]}\n";
+
+    return muduo::string(out.str().c_str());
+}
@@ -0,0 +1,108 @@
+#ifndef MEMCACHED_SAMPLER_H
+#define MEMCACHED_SAMPLER_H
+
+#include "muduo/base/StringPiece.h"
+#include "muduo/base/Timestamp.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 热点key统计. 每个线程每kSampleRate次访问采样一次, 计入count-min sketch;
+// 只有估计值超过当前top-K中最小的计数时才加锁更新top-K, 大部分采样只是几次relaxed原子加
+class HotKeys {
+    public:
+        HotKeys();
+
+        HotKeys(const HotKeys&) = delete;
+
+        HotKeys& operator=(const HotKeys&) = delete;
+
+        // hash为hashKey(key)
+        void sample(const muduo::StringPiece& key, uint64_t hash) {
+            static thread_local uint32_t tick = 0;
+            if((++tick & (kSampleRate - 1)) != 0) {
+                return;
+            }
+            uint32_t estimate = UINT32_MAX;
+            for(int row = 0; row < kDepth; ++row) {
+                uint32_t n = sketch[row * kWidth + index(hash, row)].fetch_add(1, std::memory_order_relaxed) + 1;
+                estimate = std::min(estimate, n);
+            }
+            if(estimate > minTopCount.load(std::memory_order_relaxed)) {
+                update(key, estimate);
+            }
+        }
+
+        // 所有计数减半, 定期调用使统计偏向最近的访问
+        void decay();
+
+        // {"sample_rate":16,"keys":[{"key":"...","count":...}, ...]}, count为估计的访问次数
+        muduo::string reportJson() const;
+
+    private:
+        const static int kDepth = 4;
+        const static uint32_t kWidth = 1 << 14;
+        const static size_t kTopK = 32;
+        const static uint32_t kSampleRate = 16;
+
+        struct Entry {
+            std::string key;
+            uint32_t count;
+        };
+
+        // 双重hash得到每一行的位置
+        static uint32_t index(uint64_t hash, int row) {
+            uint32_t h1 = static_cast<uint32_t>(hash);
+            uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+            return (h1 + static_cast<uint32_t>(row) * h2) & (kWidth - 1);
+        }
+
+        void update(const muduo::StringPiece& key, uint32_t estimate);
+
+        // 调用者持有mutex
+        void updateMinTopCount();
+
+        std::unique_ptr<std::atomic<uint32_t>[]> sketch;
+        mutable std::mutex mutex;
+        std::vector<Entry> top; // 按count的最小堆
+        std::atomic<uint32_t> minTopCount; // top-K满时最小的count, 否则为0
+};
+
+// 最近的慢请求, 超过上限时丢弃最早的
+class SlowRequests {
+    public:
+        explicit SlowRequests(int64_t thresholdMicros);
+
+        int64_t threshold() const { return thresholdMicros; }
+
+        // commands为同一次读事件中完成的命令数, key为其中第一个命令的key; 同时写一条日志
+        void add(const std::string& peer, const std::string& key, int commands, int64_t micros);
+
+        // {"threshold_us":...,"total":...,"requests":[{"time":...,"peer":...,"key":...,"commands":...,"latency_us":...}, ...]}
+        muduo::string reportJson() const;
+
+    private:
+        const static size_t kMaxEntries = 128;
+
+        struct Entry {
+            muduo::Timestamp time;
+            std::string peer;
+            std::string key;
+            int commands;
+            int64_t micros;
+        };
+
+        const int64_t thresholdMicros;
+        mutable std::mutex mutex;
+        std::deque<Entry> entries;
+        uint64_t total;
+};
+
+#endif
@@ -1,287 +1,495 @@
 #include "session.h"
 #include "item.h"
 #include "memcached.h"
+#include "relTime.h"
+#include "util.h"
 
-#include <boost/algorithm/string.hpp>
-
-#include <map>
+#include <algorithm>
 
+// 一次读事件中处理buffer里所有完整的命令, 回复先写入outputBuf, 最后统一发送.
 void Session::onMessage(const muduo::net::TcpConnectionPtr& conn, 
         muduo::net::Buffer* buffer, muduo::Timestamp time) {
 
-    while(buffer->findCRLF()) {
-        // read command
-        if(currentCommand == emptyString) {
-            const char* crlf = buffer->findCRLF();
-            if(crlf) {
-                size_t len = crlf - buffer->peek();
-                std::string request(buffer->peek(), len);
-                buffer->retrieveUntil(crlf + 2);
+    if(protocol == kNegotiating && buffer->readableBytes() > 0) {
+        uint8_t magic = static_cast<uint8_t>(*buffer->peek());
+        protocol = magic == binary::kRequestMagic ? kBinary : kAscii;
+    }
+    if(protocol == kBinary) {
+        processBinary(buffer);
+    }
+    else {
+        processAscii(buffer);
+    }
 
-                handleCommand(conn, request);
-            }
-            else {
-                break;
-            }
-        }
+    if(outputBuf.readableBytes() > 0 || !valueRefs.empty()) {
+        sendOutput(conn);
+    }
+    recordLatency(conn, time);
+    // 还有没发送的回复时, 发送完之后再关闭
+    if(closing && pendingOutput.empty()) {
+        conn->shutdown();
+    }
+}
 
-        // read data chunk 
-        if(currentCommand != emptyString && buffer->readableBytes() >= bytesToRead+2) {
-            std::string request(buffer->peek(), bytesToRead);        
-            buffer->retrieve(bytesToRead + 2);
+void Session::onWriteComplete(const muduo::net::TcpConnectionPtr& conn) {
+    if(pendingOutput.empty()) {
+        return;
+    }
+    flushPending(conn);
+    if(closing && pendingOutput.empty()) {
+        conn->shutdown();
+    }
+}
 
-            handleDataChunk(conn, request);
-            currentCommand = "";
-            currentKey = "";
+// 在IO线程中调用, TcpConnection::send会先尝试直接写socket,
+// 只有写不完的部分才拷贝到连接的输出缓冲区. 没有大value时整个outputBuf一次发送
+void Session::sendOutput(const muduo::net::TcpConnectionPtr& conn) {
+    if(valueRefs.empty() && pendingOutput.empty()) {
+        conn->send(&outputBuf);
+        return;
+    }
+    // 排在之前没有发送完的回复之后
+    const char* data = outputBuf.peek();
+    size_t queued = 0;
+    for(auto& ref : valueRefs) {
+        if(ref.offset > queued) {
+            pendingOutput.push_back(PendingOutput{ std::string(data + queued, ref.offset - queued), ItemPtr(), 0 });
+            queued = ref.offset;
         }
+        pendingOutput.push_back(PendingOutput{ std::string(), ref.item, 0 });
+    }
+    if(outputBuf.readableBytes() > queued) {
+        pendingOutput.push_back(PendingOutput{ std::string(data + queued, outputBuf.readableBytes() - queued),
+                ItemPtr(), 0 });
     }
+    outputBuf.retrieveAll();
+    valueRefs.clear();
+    flushPending(conn);
 }
 
-void Session::handleDataChunk(const muduo::net::TcpConnectionPtr& conn,
-        const std::string& request) {
-    if(currentCommand == cmdAdd) {
-        std::string result;
-        if(memServer->exists(currentKey)) {
-            result = notStored;
+// 只在连接的输出缓冲区为空, 即之前的数据都已写入socket时继续发送,
+// 所以socket写满时value最多有sendChunkSize字节被拷贝, 其余部分等onWriteComplete再从item发送
+void Session::flushPending(const muduo::net::TcpConnectionPtr& conn) {
+    while(!pendingOutput.empty() && conn->outputBuffer()->readableBytes() == 0) {
+        PendingOutput& front = pendingOutput.front();
+        if(!front.item) {
+            conn->send(front.data.data(), static_cast<int>(front.data.size()));
+            pendingOutput.pop_front();
+            continue;
         }
-        else {
-            memServer->set(currentKey, request, flags, expireTime);
-            result = stored;
-        }
-        if(!noreply) {
-            conn->send(result);
+        muduo::StringPiece value = front.item->value();
+        size_t n = std::min(static_cast<size_t>(value.size()) - front.offset, sendChunkSize);
+        conn->send(value.data() + front.offset, static_cast<int>(n));
+        front.offset += n;
+        if(front.offset == static_cast<size_t>(value.size())) {
+            pendingOutput.pop_front();
         }
     }
-    else if(currentCommand == cmdSet) {
-        memServer->set(currentKey, request, flags, expireTime);
-        if(!noreply) {
-            conn->send(stored);
-        }
+    // 客户端不读取回复时停止读取请求, 避免引用的item和回复无限增长
+    if(!pendingOutput.empty() && !readPaused) {
+        conn->stopRead();
+        readPaused = true;
     }
-    else if(currentCommand == cmdReplace) {
-        std::string result;
-        if(memServer->exists(currentKey)) {
-            memServer->set(currentKey, request, flags, expireTime);
-            result = stored;
-        }
-        else {
-            result = notStored;
+    else if(pendingOutput.empty() && readPaused) {
+        conn->startRead();
+        readPaused = false;
+    }
+}
+
+// 延迟从poll返回(收到请求)算起, 到回复交给TcpConnection为止, 同一次读事件中的命令延迟相同
+void Session::recordLatency(const muduo::net::TcpConnectionPtr& conn, muduo::Timestamp receiveTime) {
+    int64_t micros = -1;
+    int commands = 0;
+    for(int type = 0; type < MemcachedStat::kNumLatencyTypes; ++type) {
+        if(completedCommands[type] == 0) {
+            continue;
         }
-        if(!noreply) {
-            conn->send(result);
+        if(micros < 0) {
+            micros = muduo::Timestamp::now().microSecondsSinceEpoch() - receiveTime.microSecondsSinceEpoch();
         }
+        memServer->memStats().addLatency(static_cast<MemcachedStat::LatencyType>(type), micros,
+                completedCommands[type]);
+        commands += completedCommands[type];
+        completedCommands[type] = 0;
+    }
+    SlowRequests* slow = memServer->slowRequests();
+    if(slow != nullptr && commands > 0 && micros >= slow->threshold()) {
+        slow->add(conn->peerAddress().toIpPort(), firstKey, commands, micros);
+    }
+    firstKey.clear();
+}
+
+void Session::noteKey(const muduo::StringPiece& key) {
+    if(firstKey.empty() && !key.empty() && memServer->slowRequests() != nullptr) {
+        key.CopyToStdString(&firstKey);
+    }
+}
+
+MemcachedStat::LatencyType Session::latencyType(Command command) {
+    switch(command) {
+        case kGet:
+        case kGets:
+            return MemcachedStat::kLatencyGet;
+        case kSet:
+        case kAdd:
+        case kReplace:
+        case kAppend:
+        case kPrepend:
+            return MemcachedStat::kLatencySet;
+        case kCas:
+            return MemcachedStat::kLatencyCas;
+        case kIncr:
+            return MemcachedStat::kLatencyIncr;
+        case kDecr:
+            return MemcachedStat::kLatencyDecr;
+        case kDelete:
+            return MemcachedStat::kLatencyDelete;
+        case kTouch:
+            return MemcachedStat::kLatencyTouch;
+        default:
+            return MemcachedStat::kLatencyOther;
     }
-    else if(currentCommand == cmdAppend) {
-        std::string result;
-        if(memServer->exists(currentKey)) {
-            memServer->append(currentKey, request);
-            result = stored;
+}
+
+MemcachedStat::LatencyType Session::binaryLatencyType(uint8_t opcode) {
+    switch(binary::loudOpcode(opcode)) {
+        case binary::kGet:
+        case binary::kGetK:
+            return MemcachedStat::kLatencyGet;
+        case binary::kSet:
+        case binary::kAdd:
+        case binary::kReplace:
+        case binary::kAppend:
+        case binary::kPrepend:
+            return MemcachedStat::kLatencySet;
+        case binary::kIncrement:
+            return MemcachedStat::kLatencyIncr;
+        case binary::kDecrement:
+            return MemcachedStat::kLatencyDecr;
+        case binary::kDelete:
+            return MemcachedStat::kLatencyDelete;
+        case binary::kTouch:
+        case binary::kGat:
+        case binary::kGatK:
+            return MemcachedStat::kLatencyTouch;
+        default:
+            return MemcachedStat::kLatencyOther;
+    }
+}
+
+// 命令直接在buffer上解析, 处理完之后才retrieve
+void Session::processAscii(muduo::net::Buffer* buffer) {
+    while(!closing) {
+        // 丢弃太大的数据块, 不能把其中的内容当作命令执行
+        if(bytesToSwallow > 0) {
+            size_t n = std::min(buffer->readableBytes(), bytesToSwallow);
+            buffer->retrieve(n);
+            bytesToSwallow -= n;
+            if(bytesToSwallow > 0) {
+                break;
+            }
         }
-        else {
-            result = notStored;
+        // read command
+        else if(currentCommand == kNone) {
+            const char* crlf = buffer->findCRLF();
+            if(crlf == nullptr) {
+                break;
+            }
+            muduo::StringPiece request(buffer->peek(), static_cast<int>(crlf - buffer->peek()));
+            handleCommand(request);
+            buffer->retrieveUntil(crlf + 2);
         }
-        if(!noreply) {
-            conn->send(result);
-        }
-    }
-    else if(currentCommand == cmdPrepend) {
-        std::string result;
-       if(memServer->exists(currentKey)) {
-           memServer->prepend(currentKey, request);
-           result = stored;
-       }
-       else {
-           result = notStored;
-       }
-       if(!noreply) {
-           conn->send(result);
-       }
-    }
-    else if(currentCommand == cmdCas) {
-        std::string result;
-        if(memServer->exists(currentKey)) {
-            std::shared_ptr<const Item> item = memServer->get(currentKey);
-            uint64_t oldCas = item->getCas();
-            if(oldCas != cas) {
-                result = exists;
-
-                memServer->memStats().addCasBadValCount();
+        // read data chunk 
+        else if(buffer->readableBytes() >= bytesToRead + 2) {
+            muduo::StringPiece request(buffer->peek(), static_cast<int>(bytesToRead));
+            bool terminated = buffer->peek()[bytesToRead] == '\r' && buffer->peek()[bytesToRead + 1] == '\n';
+            if(terminated) {
+                handleDataChunk(request);
             }
             else {
-                memServer->set(currentKey, request, flags, expireTime);
-                result = stored;
-
-                memServer->memStats().addCasHitCount();
+                outputBuf.append(badChunk);
             }
+            buffer->retrieve(bytesToRead + 2);
+            completeCommand(latencyType(currentCommand));
+            currentCommand = kNone;
+            currentKey.clear();
         }
         else {
-            result = notFound;
-
-            memServer->memStats().addCasMissCount();
-        }
-        if(!noreply) {
-            conn->send(result);
+            break;
         }
     }
-    else {
-        conn->send(nonExistentCommand);
-    }
 }
 
-void Session::split(const std::string& str, std::vector<std::string>& tokens) {
-    auto iter = str.begin(); 
-    auto pre = iter;
-    while(iter != str.end()) {
-        if(*iter == ' ') {
-            tokens.push_back(std::string(pre, iter));
-            pre = iter + 1;
+void Session::handleDataChunk(const muduo::StringPiece& request) {
+    if(!memServer->itemFits(currentKey.size(), request.size())) {
+        // 和memcached一样, set失败时删除旧值, 避免读到过期的数据
+        if(currentCommand == kSet) {
+            memServer->deleteKey(currentKey);
+        }
+        if(!noreply) {
+            outputBuf.append(tooLarge);
         }
-        ++iter;
-    }
-    if(pre != str.end()) {
-        tokens.push_back(std::string(pre, str.end()));
-    }
-}
-
-void Session::handleCommand(const muduo::net::TcpConnectionPtr& conn,
-        const std::string& request) {
-    if(request.size() == 0) {
-        conn->send(nonExistentCommand);
         return;
     }
-    std::vector<std::string> tokens; 
-    //boost::split(tokens, request, boost::is_any_of(" "));
-    split(request, tokens);
-    if(tokens[0] == cmdAdd) {
-        if(validateStorageCommand(tokens, 5, conn)) {
-            setStorageCommandInfo(tokens, 5);
-        }
+
+    Memcached::Status status;
+    switch(currentCommand) {
+        case kAdd:
+            status = memServer->add(currentKey, request, flags, expireTime);
+            break;
+        case kSet:
+            status = memServer->store(Memcached::kSet, currentKey, request, flags, expireTime);
+            break;
+        case kReplace:
+            status = memServer->replace(currentKey, request, flags, expireTime);
+            break;
+        case kAppend:
+            status = memServer->appendIfExists(currentKey, request);
+            break;
+        case kPrepend:
+            status = memServer->prependIfExists(currentKey, request);
+            break;
+        case kCas:
+            // cas为0在Memcached::store中表示不检查, 而item的cas从1开始, 不可能匹配
+            if(cas == 0) {
+                status = memServer->exists(currentKey) ? Memcached::kExists : Memcached::kNotFound;
+            }
+            else {
+                status = memServer->casStore(currentKey, request, flags, expireTime, cas);
+            }
+            if(status == Memcached::kOk) {
+                memServer->memStats().addCasHitCount();
+            }
+            else if(status == Memcached::kExists) {
+                memServer->memStats().addCasBadValCount();
+            }
+            else if(status == Memcached::kNotFound) {
+                memServer->memStats().addCasMissCount();
+            }
+            break;
+        default:
+            outputBuf.append(nonExistentCommand);
+            return;
     }
-    else if(tokens[0] == cmdSet) {
-        if(validateStorageCommand(tokens, 5, conn)) {
-            memServer->memStats().addCmdSetCount();
 
-            setStorageCommandInfo(tokens, 5);
-        }
+    muduo::StringPiece result;
+    switch(status) {
+        case Memcached::kOk: result = stored; break;
+        case Memcached::kExists: result = exists; break;
+        case Memcached::kNotFound: result = notFound; break;
+        case Memcached::kOutOfMemory: result = outOfMemory; break;
+        default: result = notStored; break;
     }
-    else if(tokens[0] == cmdReplace) {
-        if(validateStorageCommand(tokens, 5, conn)) {
-            setStorageCommandInfo(tokens, 5);
-        }
+    if(!noreply) {
+        outputBuf.append(result);
     }
-    else if(tokens[0] == cmdAppend) {
-        if(validateStorageCommand(tokens, 5, conn)) {
-            setStorageCommandInfo(tokens, 5);
+}
+
+void Session::split(const muduo::StringPiece& str) {
+    tokens.clear();
+    const char* p = str.begin();
+    while(p != str.end()) {
+        while(p != str.end() && *p == ' ') {
+            ++p;
         }
-    }
-    else if(tokens[0] == cmdPrepend) {
-        if(validateStorageCommand(tokens, 5, conn)) {
-            setStorageCommandInfo(tokens, 5);
+        const char* start = p;
+        while(p != str.end() && *p != ' ') {
+            ++p;
         }
-    }
-    else if(tokens[0] == cmdCas) {
-        if(validateStorageCommand(tokens, 6, conn)) {
-            setStorageCommandInfo(tokens, 6);
+        if(p != start) {
+            tokens.push_back(muduo::StringPiece(start, static_cast<int>(p - start)));
         }
     }
-    else if(tokens[0] == cmdGet) {
-        handleGet(conn, tokens);
-    }
-    else if(tokens[0] == cmdGets) {
-        handleGetMulti(conn, tokens);
-    }
-    else if(tokens[0] == cmdDelete) {
-        handleDelete(conn, tokens);
+}
+
+Session::Command Session::lookupCommand(const muduo::StringPiece& name) {
+    const char* s = name.data();
+    switch(name.size()) {
+        case 3:
+            if(s[0] == 'g' && s[1] == 'e' && s[2] == 't') return kGet;
+            if(s[0] == 's' && s[1] == 'e' && s[2] == 't') return kSet;
+            if(s[0] == 'a' && s[1] == 'd' && s[2] == 'd') return kAdd;
+            if(s[0] == 'c' && s[1] == 'a' && s[2] == 's') return kCas;
+            break;
+        case 4:
+            switch(s[0]) {
+                case 'g': if(::memcmp(s, "gets", 4) == 0) return kGets; break;
+                case 'i': if(::memcmp(s, "incr", 4) == 0) return kIncr; break;
+                case 'd': if(::memcmp(s, "decr", 4) == 0) return kDecr; break;
+                case 'q': if(::memcmp(s, "quit", 4) == 0) return kQuit; break;
+            }
+            break;
+        case 5:
+            switch(s[0]) {
+                case 't': if(::memcmp(s, "touch", 5) == 0) return kTouch; break;
+                case 's': if(::memcmp(s, "stats", 5) == 0) return kStats; break;
+            }
+            break;
+        case 6:
+            switch(s[0]) {
+                case 'd': if(::memcmp(s, "delete", 6) == 0) return kDelete; break;
+                case 'a': if(::memcmp(s, "append", 6) == 0) return kAppend; break;
+            }
+            break;
+        case 7:
+            switch(s[0]) {
+                case 'r': if(::memcmp(s, "replace", 7) == 0) return kReplace; break;
+                case 'p': if(::memcmp(s, "prepend", 7) == 0) return kPrepend; break;
+            }
+            break;
+        case 9:
+            if(::memcmp(s, "flush_all", 9) == 0) return kFlushAll;
+            break;
     }
-    else if(tokens[0] == cmdIncr) {  //忽略多余的参数
-        handleIncr(conn, tokens);
+
+    return kUnknown;
+}
+
+void Session::handleCommand(const muduo::StringPiece& request) {
+    split(request);
+    if(tokens.empty()) {
+        outputBuf.append(nonExistentCommand);
+        return;
     }
-    else if(tokens[0] == cmdDecr) {
-        handleDecr(conn, tokens);
+    Command command = lookupCommand(tokens[0]);
+    if(tokens.size() > 1) {
+        noteKey(tokens[1]);
     }
-    else if(tokens[0] == cmdTouch) {
-        handleTouch(conn, tokens);
+    switch(command) {
+        case kSet:
+            if(validateStorageCommand(command, tokens, 5)) {
+                memServer->memStats().addCmdSetCount();
+
+                setStorageCommandInfo(command, tokens, 5);
+            }
+            break;
+        case kAdd:
+        case kReplace:
+        case kAppend:
+        case kPrepend:
+            if(validateStorageCommand(command, tokens, 5)) {
+                setStorageCommandInfo(command, tokens, 5);
+            }
+            break;
+        case kCas:
+            if(validateStorageCommand(command, tokens, 6)) {
+                setStorageCommandInfo(command, tokens, 6);
+            }
+            break;
+        case kGet:
+            handleGet(tokens);
+            break;
+        case kGets:
+            handleGetMulti(tokens);
+            break;
+        case kDelete:
+            handleDelete(tokens);
+            break;
+        case kIncr:  //忽略多余的参数
+            handleIncr(tokens);
+            break;
+        case kDecr:
+            handleDecr(tokens);
+            break;
+        case kTouch:
+            handleTouch(tokens);
+            break;
+        case kStats:
+            handleStats(tokens);
+            break;
+        case kFlushAll:
+            handleFlushAll(tokens);
+            break;
+        case kQuit:
+            closing = true;
+            break;
+        default:
+            outputBuf.append(nonExistentCommand);
+            break;
     }
-    else if(tokens[0] == cmdStats) {
-        handleStats(conn, tokens);
+    // 存储命令要等数据块读完才算完成
+    if(currentCommand == kNone) {
+        completeCommand(latencyType(command));
     }
-    else if(tokens[0] == cmdFlush) {
-        handleFlushAll(conn, tokens);
+}
+
+// VALUE <key> <flags> <bytes> [<cas>]\r\n<data>\r\n
+void Session::appendValue(const ItemPtr& item, bool withCas) {
+    char buf[kMaxUint64Length];
+    char number[kMaxUint64Length];
+    muduo::StringPiece value = item->value(number);
+    outputBuf.append("VALUE ", 6);
+    outputBuf.append(item->key());
+    outputBuf.append(" ", 1);
+    outputBuf.append(buf, formatUint(item->getFlags(), buf));
+    outputBuf.append(" ", 1);
+    outputBuf.append(buf, formatUint(value.size(), buf));
+    if(withCas) {
+        outputBuf.append(" ", 1);
+        outputBuf.append(buf, formatUint(item->getCas(), buf));
     }
-    else if(tokens[0] == cmdQuit) {
-        conn->shutdown();
+    outputBuf.append("\r\n", 2);
+    appendItemValue(item, value);
+    outputBuf.append("\r\n", 2);
+}
+
+void Session::appendItemValue(const ItemPtr& item, const muduo::StringPiece& value) {
+    if(static_cast<size_t>(value.size()) < zeroCopyThreshold) {
+        outputBuf.append(value);
     }
     else {
-        conn->send(nonExistentCommand);
+        ValueRef ref = { outputBuf.readableBytes(), item };
+        valueRefs.push_back(ref);
     }
 }
 
-void Session::handleGet(const muduo::net::TcpConnectionPtr& conn, 
-        const std::vector<std::string>& tokens) {
+void Session::appendNumber(uint64_t value) {
+    char buf[kMaxUint64Length];
+    outputBuf.append(buf, formatUint(value, buf));
+    outputBuf.append("\r\n", 2);
+}
+
+void Session::handleGet(const Tokens& tokens) {
     if(tokens.size() <= 1) {
-        conn->send(nonExistentCommand);
+        outputBuf.append(nonExistentCommand);
     }
     else {
-        std::vector<std::string> keys(++tokens.begin(), tokens.end());
-        std::map<std::string, std::shared_ptr<const Item>> values = memServer->get(keys);    
-        auto iter = ++tokens.begin();
-        while(iter != tokens.end()) {
-            auto itemIter = values.find(*iter);
-            if(itemIter != values.end()) {
-                std::string key = *iter;
-                std::string value = itemIter->second->get();
-                uint16_t flags = itemIter->second->getFlags();
-                size_t size = value.size(); 
-                outputBuf.append("VALUE " + key + " " + std::to_string(flags) + " " + std::to_string(size) + "\r\n");
-                outputBuf.append(value + "\r\n");
+        memServer->get(tokens.begin() + 1, tokens.end(), &multiGetItems);
+        for(const ItemPtr& item : multiGetItems) {
+            if(item) {
+                appendValue(item, false);
 
                 memServer->memStats().addCmdGetHitCount();
             }
             else {
                 memServer->memStats().addCmdGetMissCount();
             }
-            ++iter;
             memServer->memStats().addCmdGetCount();
         }
+        multiGetItems.clear();
         outputBuf.append(end);
-        conn->send(&outputBuf);
     }
 }
 
-void Session::handleGetMulti(const muduo::net::TcpConnectionPtr& conn,
-        const std::vector<std::string>& tokens) {
+void Session::handleGetMulti(const Tokens& tokens) {
     if(tokens.size() <= 1) {
-        conn->send(nonExistentCommand);
+        outputBuf.append(nonExistentCommand);
     }
     else {
-        std::string response("");
-        std::vector<std::string> keys(++tokens.begin(), tokens.end());
-        std::map<std::string, std::shared_ptr<const Item>> items = memServer->get(keys);
-        auto iter = ++tokens.begin();
-        while(iter != tokens.end()) {
-            auto itemIter = items.find(*iter);
-            if(itemIter != items.end()) {
-                std::string key = *iter;
-                std::string value = itemIter->second->get();
-                uint16_t flags = itemIter->second->getFlags();
-                uint64_t cas = itemIter->second->getCas();
-                size_t size = value.size();
-
-                response += "VALUE " + key + " " + std::to_string(flags)
-                    + " " + std::to_string(size) + " " + std::to_string(cas) + "\r\n";
-                response += value+"\r\n";
+        memServer->get(tokens.begin() + 1, tokens.end(), &multiGetItems);
+        for(const ItemPtr& item : multiGetItems) {
+            if(item) {
+                appendValue(item, true);
             }
-            ++iter;
         }
-        response += end;
-        conn->send(response);
+        multiGetItems.clear();
+        outputBuf.append(end);
     }
 }
 
-void Session::handleDelete(const muduo::net::TcpConnectionPtr& conn,
-        const std::vector<std::string>& tokens) {
+void Session::handleDelete(const Tokens& tokens) {
     noreply = false;
-    std::string response("");
+    muduo::StringPiece response;
     if(tokens.size() < 2) {
         response = nonExistentCommand;
     }
@@ -290,108 +498,112 @@ void Session::handleDelete(const muduo::net::TcpConnectionPtr& conn,
     }
     else {
         noreply = tokens.size() == 3 && tokens[2] == NOREPLY;
-        if(!memServer->exists(tokens[1])) {
-            response = notFound;
+        if(memServer->deleteKey(tokens[1]) == Memcached::kOk) {
+            response = deleted;
 
-            memServer->memStats().addDeleteMissCount();
+            memServer->memStats().addDeleteHitCount();
         }
         else {
-            memServer->deleteKey(tokens[1]);
-            response = deleted;
+            response = notFound;
 
-            memServer->memStats().addDeleteHitCount();
+            memServer->memStats().addDeleteMissCount();
         }
     }
     if(!noreply) {
-        conn->send(response);
+        outputBuf.append(response);
     }
 }
 
-void Session::handleIncr(const muduo::net::TcpConnectionPtr& conn,
-        const std::vector<std::string>& tokens) {
+void Session::handleIncr(const Tokens& tokens) {
     noreply = false;
-    std::string response("");
+    uint64_t value = 0;
     if(tokens.size() < 3) {
-        response = nonExistentCommand;
-    }
-    else if(!isUint64(tokens[2])) {
-        response = invalidDeltaArgument;
+        outputBuf.append(nonExistentCommand);
     }
-    else if(!memServer->exists(tokens[1])) {
-        response = notFound;
-
-        memServer->memStats().addIncrMissCount();
+    else if(!toUint(tokens[2], &value)) {
+        outputBuf.append(invalidDeltaArgument);
     }
     else {
-        std::shared_ptr<const Item> item = memServer->get(tokens[1]);
-        if(!isUint64(item->get())) {
-            response = nonNumeric;
+        uint64_t result = 0;
+        noreply = tokens.size() > 3 && tokens[3] == NOREPLY;
+        Memcached::Status status = memServer->incr(tokens[1], value, &result);
+        // 值不是数字时即使noreply也回复错误
+        if(status == Memcached::kNonNumeric) {
+            outputBuf.append(nonNumeric);
+        }
+        else if(!noreply) {
+            if(status == Memcached::kOk) {
+                appendNumber(result);
+            }
+            else if(status == Memcached::kNotFound) {
+                outputBuf.append(notFound);
+            }
+            else {
+                outputBuf.append(outOfMemory);
+            }
         }
-        else {
-            uint64_t value = std::stoull(tokens[2]);
-            uint64_t result = memServer->incr(tokens[1], value);
-            noreply = tokens.size() > 3 && tokens[3] == NOREPLY;
-            response= std::to_string(result) + "\r\n";
 
+        if(status == Memcached::kNotFound) {
+            memServer->memStats().addIncrMissCount();
+        }
+        else if(status != Memcached::kNonNumeric) {
             memServer->memStats().addIncrHitCount();
         }
     }
-    if(!noreply) {
-        conn->send(response);
-    }
 }
 
-void Session::handleDecr(const muduo::net::TcpConnectionPtr& conn,
-        const std::vector<std::string>& tokens) {
+void Session::handleDecr(const Tokens& tokens) {
     noreply = false;
-    std::string response("");
+    uint64_t value = 0;
     if(tokens.size() < 3) {
-        response = nonExistentCommand;
-    }
-    else if(!isUint64(tokens[2])) {
-        response = invalidDeltaArgument;
+        outputBuf.append(nonExistentCommand);
     }
-    else if(!memServer->exists(tokens[1])) {
-        response = notFound;
-
-        memServer->memStats().addDecrMissCount();
+    else if(!toUint(tokens[2], &value)) {
+        outputBuf.append(invalidDeltaArgument);
     }
     else {
-        std::shared_ptr<const Item> item = memServer->get(tokens[1]);
-        if(!isUint64(item->get())) {
-            response = nonNumeric;
+        uint64_t result = 0;
+        noreply = tokens.size() > 3 && tokens[3] == NOREPLY;
+        Memcached::Status status = memServer->decr(tokens[1], value, &result);
+        // 值不是数字时即使noreply也回复错误
+        if(status == Memcached::kNonNumeric) {
+            outputBuf.append(nonNumeric);
+        }
+        else if(!noreply) {
+            if(status == Memcached::kOk) {
+                appendNumber(result);
+            }
+            else if(status == Memcached::kNotFound) {
+                outputBuf.append(notFound);
+            }
+            else {
+                outputBuf.append(outOfMemory);
+            }
         }
-        else {
-            uint64_t value = std::stoull(tokens[2]);
-            uint64_t result = memServer->decr(tokens[1], value);
-            noreply = tokens.size() > 3 && tokens[3] == NOREPLY;
-            response = std::to_string(result) + "\r\n";
 
+        if(status == Memcached::kNotFound) {
             memServer->memStats().addDecrMissCount();
         }
-    }
-    if(!noreply) {
-        conn->send(response);
+        else if(status != Memcached::kNonNumeric) {
+            memServer->memStats().addDecrHitCount();
+        }
     }
 }
 
-void Session::handleTouch(const muduo::net::TcpConnectionPtr& conn,
-        const std::vector<std::string>& tokens) {
+void Session::handleTouch(const Tokens& tokens) {
     noreply = false;
-    std::string response("");
+    muduo::StringPiece response;
+    uint32_t t = 0;
     if(tokens.size() < 3) {
         response = nonExistentCommand;
     }
-    else if(!isUint32(tokens[2])) {
+    else if(!toUint(tokens[2], &t)) {
         response = invalidExptime;
     }
     else {
         noreply = tokens.size() > 3 && tokens[3] == NOREPLY;
 
-        if(memServer->exists(tokens[1])) {
-            uint32_t t = static_cast<uint32_t>(std::stoul(tokens[2]));
-            uint32_t exp = toExpireTimestamp(t);
-            memServer->touch(tokens[1], exp);;
+        if(memServer->touch(tokens[1], toExpireTime(t))) {
             response = touched;
 
             memServer->memStats().addCmdTouchHitCount();
@@ -404,31 +616,39 @@ void Session::handleTouch(const muduo::net::TcpConnectionPtr& conn,
         memServer->memStats().addCmdTouchCount();
     }
     if(!noreply) {
-        conn->send(response);
+        outputBuf.append(response);
     }
 }
 
-void Session::handleStats(const muduo::net::TcpConnectionPtr& conn,
-        const std::vector<std::string>& tokens) {
-    if(tokens.size() != 1) {
-        conn->send(nonExistentCommand);
-    }
-    else {
+void Session::handleStats(const Tokens& tokens) {
+    if(tokens.size() == 1) {
         muduo::string stats = memServer->memStats().report();
         stats = stats + end.c_str();
-        conn->send(stats);
+        outputBuf.append(stats);
+    }
+    else if(tokens.size() == 2 && tokens[1] == "slabs") {
+        muduo::string stats = memServer->memStats().reportSlabs(memServer->slabs());
+        stats = stats + end.c_str();
+        outputBuf.append(stats);
+    }
+    else if(tokens.size() == 2 && tokens[1] == "items") {
+        muduo::string stats = memServer->memStats().reportItems(memServer->lru());
+        stats = stats + end.c_str();
+        outputBuf.append(stats);
+    }
+    else {
+        outputBuf.append(nonExistentCommand);
     }
 }
 
-void Session::handleFlushAll(const muduo::net::TcpConnectionPtr& conn,
-        const std::vector<std::string>& tokens) {
+void Session::handleFlushAll(const Tokens& tokens) {
     noreply = false;
     uint32_t exptime = 0;
-    std::string result("");
+    muduo::StringPiece result;
     if(tokens.size() >= 2) {
-        if(isUint32(tokens[1])) {
-            uint32_t t = static_cast<uint32_t>(std::stoul(tokens[1]));
-            exptime = toExpireTimestamp(t);
+        uint32_t t = 0;
+        if(toUint(tokens[1], &t)) {
+            exptime = toExpireTime(t);
             noreply = tokens.size() >= 3 && tokens[2] == NOREPLY;
             memServer->flush_all(exptime);
             result = OK;
@@ -449,93 +669,475 @@ void Session::handleFlushAll(const muduo::net::TcpConnectionPtr& conn,
 
     memServer->memStats().addCmdFlushCount();
     if(!noreply) {
-        conn->send(result);
+        outputBuf.append(result);
     }
 }
 
-bool Session::isAllNumber(std::vector<std::string>::const_iterator begin, 
-        std::vector<std::string>::const_iterator end) {
-    while(begin != end) {
-        if(!(isNumber(*begin))) {
-            return false;
+// 和memcached一样, 长度为负或者接近溢出时是格式错误; 只是超过最大item时回复SERVER_ERROR,
+// 并丢弃随后的数据块
+bool Session::validateStorageCommand(Command command, const Tokens& tokens, size_t size) {
+    bool result = true;
+    if(tokens.size() < size || tokens[1].size() > maxKeyLength) {
+        outputBuf.append(badFormat);
+        result = false;
+    }
+    else {
+        // flags expireTime bytes [cas] [norely]
+        uint16_t f;
+        uint32_t n;
+        size_t bytes;
+        uint64_t c;
+        result = toUint(tokens[2], &f) && toUint(tokens[3], &n) && toUint(tokens[4], &bytes)
+            && bytes <= kMaxBytes;
+        if(size == 6) { // cas
+            result = result && toUint(tokens[5], &c);
+        }
+        noreply = tokens.size() > size && tokens[size] == NOREPLY;
+        if(!result) {
+            outputBuf.append(badFormat);
+        }
+        else if(bytes > memServer->slabs().maxChunkSize()) {
+            // 和memcached一样, set失败时删除旧值, 避免读到过期的数据
+            if(command == kSet) {
+                memServer->deleteKey(tokens[1]);
+            }
+            if(!noreply) {
+                outputBuf.append(tooLarge);
+            }
+            bytesToSwallow = bytes + 2;
+            result = false;
         }
-        ++begin;
     }
 
-    return true;
+    return result;
 }
 
-bool Session::isNumber(const std::string& str) {
-    if(str.size() == 0) {
-        return false;
+// 参数已经由validateStorageCommand检查过
+void Session::setStorageCommandInfo(Command command, const Tokens& tokens, size_t size) {
+    currentCommand = command;
+    tokens[1].CopyToStdString(&currentKey);
+    toUint(tokens[2], &flags);
+    uint32_t t = 0;
+    toUint(tokens[3], &t);
+    expireTime = toExpireTime(t);
+    toUint(tokens[4], &bytesToRead);
+    if(size == 6) {
+        toUint(tokens[5], &cas);
     }
-    for(auto& ch : str) {
-        if(!(isdigit(ch))) {
-            return false;
-        }
+}
+
+// 0 means forever. 不超过maxExpireTime的是相对当前的秒数, 否则是unix时间戳
+uint32_t Session::toExpireTime(uint32_t expt) {
+    if(expt == 0) {
+        return 0;
     }
+    if(expt <= maxExpireTime) {
+        return RelTime::now() + expt;
+    }
+
+    return RelTime::fromUnixTime(expt);
+}
+
+namespace {
 
-    return true;
+const char* binaryErrorMessage(uint16_t status) {
+    switch(status) {
+        case binary::kKeyNotFound: return "Not found";
+        case binary::kKeyExists: return "Data exists for key.";
+        case binary::kTooLarge: return "Too large.";
+        case binary::kInvalidArguments: return "Invalid arguments";
+        case binary::kNotStored: return "Not stored.";
+        case binary::kNonNumeric: return "Non-numeric server-side value for incr or decr";
+        case binary::kOutOfMemory: return "Out of memory";
+        default: return "Unknown command";
+    }
 }
 
-bool Session::isUint16(const std::string& str) {
-    return isUint(str, maxUint16);
+// add失败表示key已存在, replace失败表示key不存在
+uint16_t toBinaryStatus(Memcached::Status status, uint8_t opcode) {
+    switch(status) {
+        case Memcached::kOk: return binary::kSuccess;
+        case Memcached::kExists: return binary::kKeyExists;
+        case Memcached::kNotFound: return binary::kKeyNotFound;
+        case Memcached::kNonNumeric: return binary::kNonNumeric;
+        case Memcached::kOutOfMemory: return binary::kOutOfMemory;
+        case Memcached::kNotStored:
+            switch(binary::loudOpcode(opcode)) {
+                case binary::kAdd: return binary::kKeyExists;
+                case binary::kReplace: return binary::kKeyNotFound;
+                default: return binary::kNotStored;
+            }
+    }
+
+    return binary::kNotStored;
 }
 
-bool Session::isUint32(const std::string& str) {
-    return isUint(str, maxUint32);
 }
 
-bool Session::isUint64(const std::string& str) {
-    return isUint(str, maxUint64);
+void Session::processBinary(muduo::net::Buffer* buffer) {
+    while(!closing && buffer->readableBytes() >= binary::kHeaderSize) {
+        binary::Header header = binary::parseHeader(buffer->peek());
+        // 无法继续解析后面的数据, 直接关闭连接
+        if(header.magic != binary::kRequestMagic) {
+            closing = true;
+            break;
+        }
+        if(header.keyLength > maxKeyLength
+                || header.extrasLength + header.keyLength > header.bodyLength) {
+            appendBinaryError(header, binary::kInvalidArguments);
+            closing = true;
+            break;
+        }
+        // 和文本协议限制bytes一样, 不能为了等待过大的body无限制地增长输入buffer
+        if(header.bodyLength > memServer->slabs().maxChunkSize() + maxKeyLength + binary::kMaxExtrasSize) {
+            appendBinaryError(header, binary::kTooLarge);
+            closing = true;
+            break;
+        }
+        if(buffer->readableBytes() < binary::kHeaderSize + header.bodyLength) {
+            break;
+        }
+
+        const char* body = buffer->peek() + binary::kHeaderSize;
+        muduo::StringPiece extras(body, header.extrasLength);
+        muduo::StringPiece key(body + header.extrasLength, header.keyLength);
+        int valueLength = static_cast<int>(header.bodyLength - header.extrasLength - header.keyLength);
+        muduo::StringPiece value(body + header.extrasLength + header.keyLength, valueLength);
+        handleBinaryCommand(header, extras, key, value);
+        buffer->retrieve(binary::kHeaderSize + header.bodyLength);
+    }
 }
 
-bool Session::isUint(const std::string& str, const std::string& uint) {
-    return (isNumber(str)
-            && (str.length() < uint.length() 
-                || (str.length() == uint.length() && str < uint)));
+void Session::handleBinaryCommand(const binary::Header& header, const muduo::StringPiece& extras,
+        const muduo::StringPiece& key, const muduo::StringPiece& value) {
+    noteKey(key);
+    MemcachedStat::LatencyType type = binaryLatencyType(header.opcode);
+    completeCommand(type == MemcachedStat::kLatencySet && header.cas != 0 ? MemcachedStat::kLatencyCas : type);
+    switch(binary::loudOpcode(header.opcode)) {
+        case binary::kGet:
+        case binary::kGetK:
+        case binary::kTouch:
+        case binary::kGat:
+        case binary::kGatK:
+            binaryGet(header, extras, key, value);
+            break;
+        case binary::kSet:
+        case binary::kAdd:
+        case binary::kReplace:
+        case binary::kAppend:
+        case binary::kPrepend:
+            binaryStore(header, extras, key, value);
+            break;
+        case binary::kDelete:
+            binaryDelete(header, extras, key, value);
+            break;
+        case binary::kIncrement:
+        case binary::kDecrement:
+            binaryIncrDecr(header, extras, key, value);
+            break;
+        case binary::kFlush:
+            binaryFlush(header, extras, key, value);
+            break;
+        case binary::kStat:
+            binaryStats(header, key);
+            break;
+        case binary::kNoop:
+            appendBinaryResponse(header, binary::kSuccess, "", "", "", 0);
+            break;
+        case binary::kVersion:
+            appendBinaryResponse(header, binary::kSuccess, "", "", versionString, 0);
+            break;
+        case binary::kQuit:
+            if(!binary::isQuiet(header.opcode)) {
+                appendBinaryResponse(header, binary::kSuccess, "", "", "", 0);
+            }
+            closing = true;
+            break;
+        default:
+            appendBinaryError(header, binary::kUnknownCommand);
+            break;
+    }
 }
 
-bool Session::validateStorageCommand(const std::vector<std::string>& tokens, size_t size, 
-        const muduo::net::TcpConnectionPtr& conn) {
-    bool result = true;
-    if(tokens.size() < size) {
-        conn->send(badFormat);
-        result = false;
+// GET/GETK/TOUCH/GAT/GATK及其quiet版本, 回复的extras为4字节flags
+void Session::binaryGet(const binary::Header& header, const muduo::StringPiece& extras,
+        const muduo::StringPiece& key, const muduo::StringPiece& value) {
+    uint8_t opcode = binary::loudOpcode(header.opcode);
+    bool touch = opcode == binary::kTouch || opcode == binary::kGat || opcode == binary::kGatK;
+    if(key.empty() || !value.empty() || extras.size() != (touch ? 4 : 0)) {
+        appendBinaryError(header, binary::kInvalidArguments);
+        return;
+    }
+
+    ItemPtr item;
+    if(touch) {
+        item = memServer->touch(key, toExpireTime(binary::readUint32(extras.data())));
+        if(item) {
+            memServer->memStats().addCmdTouchHitCount();
+        }
+        else {
+            memServer->memStats().addCmdTouchMissCount();
+        }
+        memServer->memStats().addCmdTouchCount();
     }
     else {
-        // flags expireTime bytes [cas] [norely]
-        result = isUint16(tokens[2]) && isUint32(tokens[3]) && isUint32(tokens[4]);
-        if(size == 6) { // cas
-            result = result && isUint64(tokens[5]);
+        item = memServer->get(key);
+    }
+    if(opcode != binary::kTouch) {
+        memServer->memStats().addCmdGetCount();
+        if(item) {
+            memServer->memStats().addCmdGetHitCount();
         }
-        noreply = tokens.size() > size && tokens[size] == NOREPLY;
-        if(!result) {
-            conn->send(badFormat);
+        else {
+            memServer->memStats().addCmdGetMissCount();
         }
     }
 
-    return result;
+    if(!item) {
+        if(!binary::isQuiet(header.opcode)) {
+            appendBinaryError(header, binary::kKeyNotFound);
+        }
+        return;
+    }
+    uint32_t flags = muduo::net::sockets::hostToNetwork32(item->getFlags());
+    muduo::StringPiece flagsPiece(reinterpret_cast<const char*>(&flags), sizeof flags);
+    muduo::StringPiece responseKey = opcode == binary::kGetK || opcode == binary::kGatK
+        ? key : muduo::StringPiece();
+    char number[kMaxUint64Length];
+    muduo::StringPiece itemValue = opcode != binary::kTouch ? item->value(number) : muduo::StringPiece();
+    appendBinaryHeader(header, binary::kSuccess, flagsPiece.size(), responseKey.size(),
+            itemValue.size(), item->getCas());
+    outputBuf.append(flagsPiece);
+    outputBuf.append(responseKey);
+    if(!itemValue.empty()) {
+        appendItemValue(item, itemValue);
+    }
 }
 
-void Session::setStorageCommandInfo(const std::vector<std::string>& tokens, size_t size) {
-    currentCommand = tokens[0];
-    currentKey = tokens[1];
-    flags = static_cast<uint16_t>(stoul(tokens[2]));
-    uint32_t t = static_cast<uint32_t>(std::stoul(tokens[3]));
-    expireTime = toExpireTimestamp(t);
-    bytesToRead = static_cast<uint32_t>(stoul(tokens[4]));
-    if(size == 6) {
-        cas = stoull(tokens[5]);
+// SET/ADD/REPLACE的extras为flags(4) + exptime(4), APPEND/PREPEND没有extras.
+// header中的cas不为0时只有cas匹配才更新
+void Session::binaryStore(const binary::Header& header, const muduo::StringPiece& extras,
+        const muduo::StringPiece& key, const muduo::StringPiece& value) {
+    uint8_t opcode = binary::loudOpcode(header.opcode);
+    bool concat = opcode == binary::kAppend || opcode == binary::kPrepend;
+    if(key.empty() || extras.size() != (concat ? 0 : 8)) {
+        appendBinaryError(header, binary::kInvalidArguments);
+        return;
+    }
+    if(!memServer->itemFits(key.size(), value.size())) {
+        // 和memcached一样, set失败时删除旧值, 避免读到过期的数据
+        if(opcode == binary::kSet) {
+            memServer->deleteKey(key);
+        }
+        appendBinaryError(header, binary::kTooLarge);
+        return;
+    }
+    if(opcode == binary::kSet) {
+        memServer->memStats().addCmdSetCount();
+    }
+
+    Memcached::StoreMode mode = Memcached::kSet;
+    uint16_t flags = 0;
+    uint32_t exptime = 0;
+    switch(opcode) {
+        case binary::kAdd: mode = Memcached::kAdd; break;
+        case binary::kReplace: mode = Memcached::kReplace; break;
+        case binary::kAppend: mode = Memcached::kAppend; break;
+        case binary::kPrepend: mode = Memcached::kPrepend; break;
+    }
+    if(!concat) {
+        flags = static_cast<uint16_t>(binary::readUint32(extras.data()));
+        exptime = toExpireTime(binary::readUint32(extras.data() + 4));
+    }
+    uint64_t cas = 0;
+    Memcached::Status result = memServer->store(mode, key, value, flags, exptime, header.cas, &cas);
+    if(header.cas != 0) {
+        if(result == Memcached::kNotFound) {
+            memServer->memStats().addCasMissCount();
+        }
+        else if(result == Memcached::kExists) {
+            memServer->memStats().addCasBadValCount();
+        }
+        else {
+            memServer->memStats().addCasHitCount();
+        }
+    }
+
+    uint16_t status = toBinaryStatus(result, opcode);
+    if(status != binary::kSuccess) {
+        appendBinaryError(header, status);
+    }
+    else if(!binary::isQuiet(header.opcode)) {
+        appendBinaryResponse(header, binary::kSuccess, "", "", "", cas);
+    }
+}
+
+void Session::binaryDelete(const binary::Header& header, const muduo::StringPiece& extras,
+        const muduo::StringPiece& key, const muduo::StringPiece& value) {
+    if(key.empty() || !extras.empty() || !value.empty()) {
+        appendBinaryError(header, binary::kInvalidArguments);
+        return;
+    }
+
+    Memcached::Status result = memServer->deleteKey(key, header.cas);
+    if(result == Memcached::kOk) {
+        memServer->memStats().addDeleteHitCount();
+    }
+    else if(result == Memcached::kNotFound) {
+        memServer->memStats().addDeleteMissCount();
+    }
+
+    uint16_t status = toBinaryStatus(result, header.opcode);
+    if(status != binary::kSuccess) {
+        appendBinaryError(header, status);
+    }
+    else if(!binary::isQuiet(header.opcode)) {
+        appendBinaryResponse(header, binary::kSuccess, "", "", "", 0);
     }
 }
 
-// 0 means forever
-uint32_t Session::toExpireTimestamp(uint32_t expt) {
-    uint32_t time = expt;
-    if(expt != 0 && expt <= maxExpireTime) {
-        time = static_cast<uint32_t>(muduo::Timestamp::now().secondsSinceEpoch()) + expt;
+// extras为delta(8) + initial(8) + exptime(4). key不存在时用initial创建,
+// exptime为0xffffffff时不创建
+void Session::binaryIncrDecr(const binary::Header& header, const muduo::StringPiece& extras,
+        const muduo::StringPiece& key, const muduo::StringPiece& value) {
+    if(key.empty() || extras.size() != 20 || !value.empty()) {
+        appendBinaryError(header, binary::kInvalidArguments);
+        return;
     }
+    bool incr = binary::loudOpcode(header.opcode) == binary::kIncrement;
+    uint64_t delta = binary::readUint64(extras.data());
+    uint64_t initial = binary::readUint64(extras.data() + 8);
+    uint32_t exptime = binary::readUint32(extras.data() + 16);
+
+    uint64_t result = 0;
+    uint64_t cas = 0;
+    Memcached::Status status = incr ? memServer->incr(key, delta, &result, header.cas, &cas)
+        : memServer->decr(key, delta, &result, header.cas, &cas);
+    if(status == Memcached::kNotFound) {
+        if(exptime != 0xffffffff) {
+            char buf[kMaxUint64Length];
+            size_t len = formatUint(initial, buf);
+            muduo::StringPiece str(buf, static_cast<int>(len));
+            status = memServer->add(key, str, 0, toExpireTime(exptime), &cas);
+            if(status == Memcached::kOk) {
+                result = initial;
+            }
+            // 其他连接刚刚创建了这个key
+            else if(status == Memcached::kNotStored) {
+                status = incr ? memServer->incr(key, delta, &result, header.cas, &cas)
+                    : memServer->decr(key, delta, &result, header.cas, &cas);
+            }
+        }
+        if(incr) {
+            memServer->memStats().addIncrMissCount();
+        }
+        else {
+            memServer->memStats().addDecrMissCount();
+        }
+    }
+    else if(status == Memcached::kOk || status == Memcached::kOutOfMemory) {
+        if(incr) {
+            memServer->memStats().addIncrHitCount();
+        }
+        else {
+            memServer->memStats().addDecrHitCount();
+        }
+    }
+
+    if(status != Memcached::kOk) {
+        appendBinaryError(header, toBinaryStatus(status, header.opcode));
+    }
+    else if(!binary::isQuiet(header.opcode)) {
+        uint64_t be = muduo::net::sockets::hostToNetwork64(result);
+        muduo::StringPiece body(reinterpret_cast<const char*>(&be), sizeof be);
+        appendBinaryResponse(header, binary::kSuccess, "", "", body, cas);
+    }
+}
+
+// extras可以为空, 或者是4字节的exptime
+void Session::binaryFlush(const binary::Header& header, const muduo::StringPiece& extras,
+        const muduo::StringPiece& key, const muduo::StringPiece& value) {
+    if(!key.empty() || !value.empty() || (extras.size() != 0 && extras.size() != 4)) {
+        appendBinaryError(header, binary::kInvalidArguments);
+        return;
+    }
+    uint32_t exptime = 0;
+    if(extras.size() == 4) {
+        exptime = toExpireTime(binary::readUint32(extras.data()));
+    }
+    memServer->flush_all(exptime);
+
+    memServer->memStats().addCmdFlushCount();
+    if(!binary::isQuiet(header.opcode)) {
+        appendBinaryResponse(header, binary::kSuccess, "", "", "", 0);
+    }
+}
+
+// 每个统计项一个回复包(key为名字, value为值), 最后以key和value都为空的包结束.
+// 不支持的统计类型只返回结束包
+void Session::binaryStats(const binary::Header& header, const muduo::StringPiece& key) {
+    muduo::string stats;
+    if(key.empty()) {
+        stats = memServer->memStats().report();
+    }
+    else if(key == "slabs") {
+        stats = memServer->memStats().reportSlabs(memServer->slabs());
+    }
+    else if(key == "items") {
+        stats = memServer->memStats().reportItems(memServer->lru());
+    }
+
+    // 每一行的格式为"STAT <name> <value>\r\n"
+    const muduo::StringPiece prefix("STAT ");
+    muduo::StringPiece rest(stats.data(), static_cast<int>(stats.size()));
+    while(!rest.empty()) {
+        const char* eol = static_cast<const char*>(::memchr(rest.data(), '\r', rest.size()));
+        if(eol == nullptr) {
+            break;
+        }
+        muduo::StringPiece line(rest.data(), static_cast<int>(eol - rest.data()));
+        rest.remove_prefix(line.size() + 2);
+        if(!line.starts_with(prefix)) {
+            continue;
+        }
+        line.remove_prefix(prefix.size());
+        const char* space = static_cast<const char*>(::memchr(line.data(), ' ', line.size()));
+        if(space == nullptr) {
+            continue;
+        }
+        int nameLength = static_cast<int>(space - line.data());
+        muduo::StringPiece name(line.data(), nameLength);
+        muduo::StringPiece statValue(space + 1, line.size() - nameLength - 1);
+        appendBinaryResponse(header, binary::kSuccess, "", name, statValue, 0);
+    }
+    appendBinaryResponse(header, binary::kSuccess, "", "", "", 0);
+}
+
+void Session::appendBinaryHeader(const binary::Header& request, uint16_t status,
+        size_t extrasLength, size_t keyLength, size_t valueLength, uint64_t cas) {
+    binary::Header header;
+    header.magic = binary::kResponseMagic;
+    header.opcode = request.opcode;
+    header.keyLength = static_cast<uint16_t>(keyLength);
+    header.extrasLength = static_cast<uint8_t>(extrasLength);
+    header.dataType = 0;
+    header.status = status;
+    header.bodyLength = static_cast<uint32_t>(extrasLength + keyLength + valueLength);
+    header.opaque = request.opaque;
+    header.cas = cas;
+    binary::appendHeader(&outputBuf, header);
+}
+
+void Session::appendBinaryResponse(const binary::Header& request, uint16_t status,
+        const muduo::StringPiece& extras, const muduo::StringPiece& key,
+        const muduo::StringPiece& value, uint64_t cas) {
+    appendBinaryHeader(request, status, extras.size(), key.size(), value.size(), cas);
+    outputBuf.append(extras);
+    outputBuf.append(key);
+    outputBuf.append(value);
+}
 
-    return time;
+// 出错时value为错误信息
+void Session::appendBinaryError(const binary::Header& request, uint16_t status) {
+    appendBinaryResponse(request, status, "", "", binaryErrorMessage(status), 0);
 }
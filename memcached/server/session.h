@@ -3,62 +3,132 @@
 
 #include "muduo/net/TcpConnection.h"
 
+#include "binaryProtocol.h"
+#include "item.h"
+#include "stat.h"
+
 #include <boost/bind.hpp>
 
+#include <limits.h>
+
+#include <deque>
+#include <vector>
+
 class Memcached;
 
 class Session {
     public:
         Session(Memcached* memServer, const muduo::net::TcpConnectionPtr& conn) 
-            :memServer(memServer), currentCommand(""), currentKey(""), flags(0), 
-            expireTime(0), bytesToRead(0), cas(0), noreply(false)  {
+            :memServer(memServer), protocol(kNegotiating), currentCommand(kNone), currentKey(""), flags(0), 
+            expireTime(0), bytesToRead(0), bytesToSwallow(0), cas(0), noreply(false), closing(false), readPaused(false),
+            completedCommands()  {
                 conn->setMessageCallback(boost::bind(&Session::onMessage, this, _1, _2, _3));
+                conn->setWriteCompleteCallback(boost::bind(&Session::onWriteComplete, this, _1));
         }
 
-        void handleCommand(const muduo::net::TcpConnectionPtr& conn, const std::string& request);
+        // tokens都指向输入buffer, 只在处理当前命令期间有效
+        typedef std::vector<muduo::StringPiece> Tokens;
 
-        void handleDataChunk(const muduo::net::TcpConnectionPtr& conn, const std::string& request);
+        void handleCommand(const muduo::StringPiece& request);
 
-        void handleGet(const muduo::net::TcpConnectionPtr& conn, const std::vector<std::string>& tokens);
+        void handleDataChunk(const muduo::StringPiece& request);
 
-        void handleGetMulti(const muduo::net::TcpConnectionPtr& conn, const std::vector<std::string>& tokens);
+        void handleGet(const Tokens& tokens);
 
-        void handleDelete(const muduo::net::TcpConnectionPtr& conn, const std::vector<std::string>& tokens);
+        void handleGetMulti(const Tokens& tokens);
 
-        void handleIncr(const muduo::net::TcpConnectionPtr& conn, const std::vector<std::string>& tokens);
+        void handleDelete(const Tokens& tokens);
 
-        void handleDecr(const muduo::net::TcpConnectionPtr& conn, const std::vector<std::string>& tokens);
+        void handleIncr(const Tokens& tokens);
 
-        void handleTouch(const muduo::net::TcpConnectionPtr& conn, const std::vector<std::string>& tokens);
+        void handleDecr(const Tokens& tokens);
 
-        void handleStats(const muduo::net::TcpConnectionPtr& conn, const std::vector<std::string>& tokens);
+        void handleTouch(const Tokens& tokens);
 
-        void handleFlushAll(const muduo::net::TcpConnectionPtr& conn, const std::vector<std::string>& tokens);
+        void handleStats(const Tokens& tokens);
 
-    private:
-        void onMessage(const muduo::net::TcpConnectionPtr& conn,
-                muduo::net::Buffer* buffer, muduo::Timestamp time);
+        void handleFlushAll(const Tokens& tokens);
 
-        bool isNumber(const std::string& str);
-        bool isAllNumber(std::vector<std::string>::const_iterator begin, 
-                std::vector<std::string>::const_iterator end);
-        bool isUint64(const std::string& str);
-        bool isUint32(const std::string& str);
-        bool isUint16(const std::string& str);
-        bool isUint(const std::string& str, const std::string& uint);
-
-        void split(const std::string& str, std::vector<std::string>& tokens);
+    private:
+        // 根据连接上第一个字节决定使用文本协议还是二进制协议
+        enum Protocol { kNegotiating, kAscii, kBinary };
 
-        bool validateStorageCommand(const std::vector<std::string>& tokens, size_t size, const muduo::net::TcpConnectionPtr& conn);
-        void setStorageCommandInfo(const std::vector<std::string>& tokens, size_t size);
+        enum Command {
+            kNone, kUnknown, kAdd, kSet, kReplace, kAppend, kPrepend, kCas,
+            kIncr, kDecr, kTouch, kDelete, kGet, kGets, kStats, kFlushAll, kQuit
+        };
 
-        uint32_t toExpireTimestamp(uint32_t exptime);
+        void onMessage(const muduo::net::TcpConnectionPtr& conn,
+                muduo::net::Buffer* buffer, muduo::Timestamp time);
+        // 连接的输出缓冲区已经全部写入socket
+        void onWriteComplete(const muduo::net::TcpConnectionPtr& conn);
+
+        // 记录本次读事件中完成的命令, 回复写入连接之后统一计算延迟
+        void completeCommand(MemcachedStat::LatencyType type) { ++completedCommands[type]; }
+        void recordLatency(const muduo::net::TcpConnectionPtr& conn, muduo::Timestamp receiveTime);
+        // 开启慢请求记录时保存本次读事件中第一个命令的key
+        void noteKey(const muduo::StringPiece& key);
+        static MemcachedStat::LatencyType latencyType(Command command);
+        static MemcachedStat::LatencyType binaryLatencyType(uint8_t opcode);
+
+        void processAscii(muduo::net::Buffer* buffer);
+
+        // 每次处理一个完整的包(header + body), 不完整时等待更多数据
+        void processBinary(muduo::net::Buffer* buffer);
+
+        void handleBinaryCommand(const binary::Header& header, const muduo::StringPiece& extras,
+                const muduo::StringPiece& key, const muduo::StringPiece& value);
+        void binaryGet(const binary::Header& header, const muduo::StringPiece& extras,
+                const muduo::StringPiece& key, const muduo::StringPiece& value);
+        void binaryStore(const binary::Header& header, const muduo::StringPiece& extras,
+                const muduo::StringPiece& key, const muduo::StringPiece& value);
+        void binaryDelete(const binary::Header& header, const muduo::StringPiece& extras,
+                const muduo::StringPiece& key, const muduo::StringPiece& value);
+        void binaryIncrDecr(const binary::Header& header, const muduo::StringPiece& extras,
+                const muduo::StringPiece& key, const muduo::StringPiece& value);
+        void binaryFlush(const binary::Header& header, const muduo::StringPiece& extras,
+                const muduo::StringPiece& key, const muduo::StringPiece& value);
+        void binaryStats(const binary::Header& header, const muduo::StringPiece& key);
+
+        void appendBinaryHeader(const binary::Header& request, uint16_t status,
+                size_t extrasLength, size_t keyLength, size_t valueLength, uint64_t cas);
+        void appendBinaryResponse(const binary::Header& request, uint16_t status,
+                const muduo::StringPiece& extras, const muduo::StringPiece& key,
+                const muduo::StringPiece& value, uint64_t cas);
+        void appendBinaryError(const binary::Header& request, uint16_t status);
+
+        // 先按长度再按首字母分派, 不做字符串拷贝
+        static Command lookupCommand(const muduo::StringPiece& name);
+
+        // 按空格切分, 结果写入tokens(复用已有的容量)
+        void split(const muduo::StringPiece& str);
+
+        bool validateStorageCommand(Command command, const Tokens& tokens, size_t size);
+        void setStorageCommandInfo(Command command, const Tokens& tokens, size_t size);
+
+        void appendValue(const ItemPtr& item, bool withCas);
+
+        // 较大的value不拷贝到outputBuf, 只记录它在回复中的位置和item的引用.
+        // value为item->value(buf)的结果
+        void appendItemValue(const ItemPtr& item, const muduo::StringPiece& value);
+
+        // 按顺序发送outputBuf和引用的value, value直接从item的内存写到连接.
+        // socket写满时剩下的部分留在pendingOutput中, 继续引用item, 可写时再发送
+        void sendOutput(const muduo::net::TcpConnectionPtr& conn);
+        void flushPending(const muduo::net::TcpConnectionPtr& conn);
+        void appendNumber(uint64_t value);
+
+        // 客户端的exptime转换为RelTime
+        uint32_t toExpireTime(uint32_t exptime);
 
         const uint32_t maxExpireTime = 2592000;
-        const std::string maxUint64 = "18446744073709551616";
-        const std::string maxUint32 = "4294967296";
-        const std::string maxUint16 = "65536";
+        const int maxKeyLength = 250;
+        // 超过这个大小的value不拷贝到outputBuf
+        const size_t zeroCopyThreshold = 16 * 1024;
+        // value每次交给连接的最大字节数, socket写满时最多拷贝这么多到连接的输出缓冲区
+        const size_t sendChunkSize = 64 * 1024;
 
+        const std::string versionString = "1.4.24";
         const std::string NOREPLY = "noreply";
         const std::string OK = "OK\r\n";
         const std::string nonExistentCommand = "ERROR\r\n";
@@ -75,34 +145,43 @@ class Session {
         const std::string touched = "TOUCHED\r\n";
         const std::string deleteArgumentError = "CLIENT_ERROR bad command line format.  Usage: delete <key> [noreply]\r\n";
         const std::string badChunk = "CLIENT_ERROR bad data chunk\r\n";
-
-        const std::string emptyString = "";
-        const std::string cmdAdd = "add";
-        const std::string cmdSet = "set";
-        const std::string cmdReplace = "replace";
-        const std::string cmdAppend = "append";
-        const std::string cmdPrepend = "prepend";
-        const std::string cmdCas = "cas";
-        const std::string cmdIncr = "incr";
-        const std::string cmdDecr = "decr";
-        const std::string cmdTouch = "touch";
-        const std::string cmdDelete = "delete";
-        const std::string cmdGet = "get";
-        const std::string cmdGets = "gets";
-        const std::string cmdStats = "stats";
-        const std::string cmdFlush = "flush_all";
-        const std::string cmdQuit = "quit";
+        const std::string tooLarge = "SERVER_ERROR object too large for cache\r\n";
+        // 存储命令数据块长度的上限, 和memcached一样超过时是格式错误
+        const static size_t kMaxBytes = INT_MAX - 2;
+        const std::string outOfMemory = "SERVER_ERROR out of memory storing object\r\n";
 
         Memcached* memServer;
 
-        std::string currentCommand;
+        Protocol protocol;
+        Command currentCommand;
         std::string currentKey;
         uint16_t flags;
         uint32_t expireTime;
-        uint32_t bytesToRead;
+        size_t bytesToRead; // 不超过最大item, 加上\r\n不会溢出
+        size_t bytesToSwallow; // 太大的数据块还没有读到的部分, 读到后直接丢弃
         uint64_t cas;
         bool noreply;
-        muduo::net::Buffer outputBuf;
+        bool closing; // 收到quit, 发送完已有的回复后关闭连接
+        bool readPaused; // 有回复没有发送完时不再读取新的请求
+        Tokens tokens;
+        muduo::net::Buffer outputBuf; // 本次读事件产生的所有回复
+
+        struct ValueRef {
+            size_t offset;  // value在outputBuf中应该插入的位置
+            ItemPtr item;
+        };
+        std::vector<ValueRef> valueRefs;
+
+        // 还没有交给连接的回复: item为空时是data中的文本, 否则是item的value从offset开始的部分
+        struct PendingOutput {
+            std::string data;
+            ItemPtr item;
+            size_t offset;
+        };
+        std::deque<PendingOutput> pendingOutput;
+        std::vector<ItemPtr> multiGetItems; // 复用multiget的结果数组, 用完后清空
+        int completedCommands[MemcachedStat::kNumLatencyTypes];
+        std::string firstKey;
 };
 
 #endif
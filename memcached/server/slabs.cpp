@@ -0,0 +1,122 @@
+#include "slabs.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+SlabAllocator::SlabAllocator(size_t memLimit, double factor, size_t minChunkSize)
+    : memLimit_(memLimit), numClasses(0), memMalloced_(0) {
+    const size_t align = 8;
+    size_t size = minChunkSize;
+    unsigned int id = 1;
+    // 最后一个class的chunk大小为kPageSize, 每个page只有一个chunk
+    while(id < kMaxClasses - 1 && size <= kPageSize / factor) {
+        if(size % align) {
+            size += align - size % align;
+        }
+        classes[id].size = size;
+        classes[id].perPage = kPageSize / size;
+        size = static_cast<size_t>(size * factor);
+        ++id;
+    }
+    classes[id].size = kPageSize;
+    classes[id].perPage = 1;
+    numClasses = id;
+}
+
+SlabAllocator::~SlabAllocator() {
+    for(auto page : pages) {
+        ::free(page);
+    }
+}
+
+unsigned int SlabAllocator::classId(size_t size) const {
+    if(size == 0 || size > kPageSize) {
+        return 0;
+    }
+    unsigned int id = 1;
+    while(size > classes[id].size) {
+        ++id;
+    }
+
+    return id;
+}
+
+// 每个class至少可以分配一个page, 即使超过了内存上限
+bool SlabAllocator::newPage(SlabClass& cls) {
+    size_t len = cls.size * cls.perPage;
+    char* page = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(memLock);
+        if(memMalloced_ + len > memLimit_ && cls.totalPages > 0) {
+            return false;
+        }
+        page = static_cast<char*>(::malloc(len));
+        if(page == nullptr) {
+            return false;
+        }
+        memMalloced_ += len;
+        pages.push_back(page);
+    }
+
+    for(size_t i = 0; i < cls.perPage; ++i) {
+        void* chunk = page + i * cls.size;
+        *static_cast<void**>(chunk) = cls.freeList;
+        cls.freeList = chunk;
+    }
+    cls.freeCount += cls.perPage;
+    cls.totalPages++;
+
+    return true;
+}
+
+void* SlabAllocator::alloc(unsigned int id) {
+    assert(id > 0 && id <= numClasses);
+    SlabClass& cls = classes[id];
+    std::lock_guard<std::mutex> lock(cls.lock);
+    if(cls.freeList == nullptr && !newPage(cls)) {
+        return nullptr;
+    }
+    void* chunk = cls.freeList;
+    cls.freeList = *static_cast<void**>(chunk);
+    cls.freeCount--;
+    cls.usedChunks++;
+
+    return chunk;
+}
+
+void SlabAllocator::free(void* ptr, unsigned int id) {
+    assert(id > 0 && id <= numClasses);
+    SlabClass& cls = classes[id];
+    std::lock_guard<std::mutex> lock(cls.lock);
+    *static_cast<void**>(ptr) = cls.freeList;
+    cls.freeList = ptr;
+    cls.freeCount++;
+    cls.usedChunks--;
+}
+
+size_t SlabAllocator::memMalloced() const {
+    std::lock_guard<std::mutex> lock(memLock);
+    return memMalloced_;
+}
+
+std::vector<SlabClassStat> SlabAllocator::stats() const {
+    std::vector<SlabClassStat> result;
+    for(unsigned int id = 1; id <= numClasses; ++id) {
+        const SlabClass& cls = classes[id];
+        std::lock_guard<std::mutex> lock(cls.lock);
+        if(cls.totalPages == 0) {
+            continue;
+        }
+        SlabClassStat stat;
+        stat.id = id;
+        stat.chunkSize = cls.size;
+        stat.chunksPerPage = cls.perPage;
+        stat.totalPages = cls.totalPages;
+        stat.totalChunks = cls.totalPages * cls.perPage;
+        stat.usedChunks = cls.usedChunks;
+        stat.freeChunks = cls.freeCount;
+        result.push_back(stat);
+    }
+
+    return result;
+}
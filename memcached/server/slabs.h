@@ -0,0 +1,77 @@
+#ifndef MEMCACHED_SLABS_H
+#define MEMCACHED_SLABS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+struct SlabClassStat {
+    unsigned int id;
+    size_t chunkSize;
+    size_t chunksPerPage;
+    size_t totalPages;
+    size_t totalChunks;
+    size_t usedChunks;
+    size_t freeChunks;
+};
+
+// 内存被切成固定大小(kPageSize)的page, 每个page属于一个slab class,
+// 再被切成该class大小的chunk. item(头部 + key + value)整个存放在一个chunk中.
+class SlabAllocator {
+    public:
+        // memLimit: 所有page的总大小上限; factor: 相邻class的chunk大小比例
+        SlabAllocator(size_t memLimit, double factor = 1.25, size_t minChunkSize = 96);
+
+        SlabAllocator(const SlabAllocator&) = delete;
+
+        SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+        ~SlabAllocator();
+
+        // 返回能容纳size字节的最小class, 0表示size超过了最大的chunk
+        unsigned int classId(size_t size) const;
+
+        // 从class id中分配一个chunk, 内存达到上限时返回nullptr
+        void* alloc(unsigned int id);
+
+        void free(void* ptr, unsigned int id);
+
+        size_t maxChunkSize() const { return kPageSize; }
+
+        size_t memLimit() const { return memLimit_; }
+
+        size_t memMalloced() const;
+
+        std::vector<SlabClassStat> stats() const;
+
+        const static size_t kPageSize = 1024 * 1024;
+        const static unsigned int kMaxClasses = 64;
+
+    private:
+        struct SlabClass {
+            SlabClass() : size(0), perPage(0), freeList(nullptr), freeCount(0),
+                totalPages(0), usedChunks(0) {}
+
+            size_t size;
+            size_t perPage;
+            void* freeList;   // 空闲chunk的前8个字节保存下一个空闲chunk
+            size_t freeCount;
+            size_t totalPages;
+            size_t usedChunks;
+            mutable std::mutex lock;
+        };
+
+        bool newPage(SlabClass& cls);
+
+        const size_t memLimit_;
+        unsigned int numClasses;
+        SlabClass classes[kMaxClasses];
+
+        mutable std::mutex memLock;
+        size_t memMalloced_;
+        std::vector<char*> pages;
+};
+
+#endif
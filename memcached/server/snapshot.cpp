@@ -0,0 +1,141 @@
+#include "snapshot.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t kWriteBufferSize = 4 * 1024 * 1024;
+
+}
+
+SnapshotWriter::SnapshotWriter() : file(nullptr), offset(0) {
+}
+
+SnapshotWriter::~SnapshotWriter() {
+    // 没有commit, 丢弃临时文件
+    if(file != nullptr) {
+        ::fclose(file);
+        ::unlink(tmpPath.c_str());
+    }
+}
+
+bool SnapshotWriter::open(const std::string& filePath, int sections) {
+    path = filePath;
+    tmpPath = filePath + ".tmp";
+    file = ::fopen(tmpPath.c_str(), "wb");
+    if(file == nullptr) {
+        return false;
+    }
+    buffer.resize(kWriteBufferSize);
+    ::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+
+    snapshot::FileHeader header;
+    ::memset(&header, 0, sizeof(header));
+    ::memcpy(header.magic, snapshot::kMagic, sizeof(header.magic));
+    header.version = snapshot::kVersion;
+    header.sections = static_cast<uint32_t>(sections);
+    header.createTime = static_cast<int64_t>(::time(nullptr));
+    write(&header, sizeof(header));
+    // section的偏移在commit时填写
+    offsets.assign(sections + 1, 0);
+    write(offsets.data(), offsets.size() * sizeof(uint64_t));
+    offsets.clear();
+    offset = 0;
+
+    return ::ferror(file) == 0;
+}
+
+void SnapshotWriter::beginSection(int section) {
+    assert(static_cast<int>(offsets.size()) == section);
+    offsets.push_back(offset);
+}
+
+void SnapshotWriter::append(const snapshot::Record& record) {
+    snapshot::RecordHeader header;
+    ::memset(&header, 0, sizeof(header));
+    header.cas = record.cas;
+    header.expireTime = static_cast<int64_t>(record.expireTime);
+    header.nbytes = static_cast<uint32_t>(record.value.size());
+    header.flags = record.flags;
+    header.nkey = static_cast<uint8_t>(record.key.size());
+    write(&header, sizeof(header));
+    write(record.key.data(), record.key.size());
+    write(record.value.data(), record.value.size());
+}
+
+void SnapshotWriter::write(const void* data, size_t size) {
+    ::fwrite(data, 1, size, file);
+    offset += size;
+}
+
+bool SnapshotWriter::commit() {
+    offsets.push_back(offset);
+    bool ok = ::fseek(file, sizeof(snapshot::FileHeader), SEEK_SET) == 0
+        && ::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file) == offsets.size()
+        && ::fflush(file) == 0 && ::ferror(file) == 0 && ::fsync(::fileno(file)) == 0;
+    ok = ::fclose(file) == 0 && ok;
+    file = nullptr;
+    if(ok && ::rename(tmpPath.c_str(), path.c_str()) == 0) {
+        return true;
+    }
+    ::unlink(tmpPath.c_str());
+
+    return false;
+}
+
+SnapshotReader::SnapshotReader() : data(nullptr), size(0), createTime_(0) {
+}
+
+SnapshotReader::~SnapshotReader() {
+    if(data != nullptr) {
+        ::munmap(const_cast<char*>(data), size);
+    }
+}
+
+bool SnapshotReader::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(snapshot::FileHeader)) {
+        ::close(fd);
+        return false;
+    }
+    size = static_cast<size_t>(st.st_size);
+    void* addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(addr == MAP_FAILED) {
+        size = 0;
+        return false;
+    }
+    data = static_cast<const char*>(addr);
+    // 各个加载线程同时缺页, 让内核提前读入整个文件
+    ::madvise(addr, size, MADV_WILLNEED);
+
+    snapshot::FileHeader header;
+    ::memcpy(&header, data, sizeof(header));
+    if(::memcmp(header.magic, snapshot::kMagic, sizeof(header.magic)) != 0
+            || header.version != snapshot::kVersion || header.sections == 0
+            || (size - sizeof(header)) / sizeof(uint64_t) < header.sections + 1) {
+        return false;
+    }
+    createTime_ = static_cast<time_t>(header.createTime);
+    offsets.resize(header.sections + 1);
+    ::memcpy(offsets.data(), data + sizeof(header), offsets.size() * sizeof(uint64_t));
+    // 偏移相对于第一条记录, 转换为相对于文件开头
+    uint64_t base = sizeof(header) + offsets.size() * sizeof(uint64_t);
+    for(size_t i = 0; i < offsets.size(); ++i) {
+        offsets[i] += base;
+        if(offsets[i] > size || (i > 0 && offsets[i] < offsets[i - 1])) {
+            offsets.clear();
+            return false;
+        }
+    }
+
+    return true;
+}
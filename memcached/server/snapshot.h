@@ -0,0 +1,131 @@
+#ifndef MEMCACHED_SNAPSHOT_H
+#define MEMCACHED_SNAPSHOT_H
+
+#include "muduo/base/StringPiece.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+// 快照文件: FileHeader, sections + 1个section相对于第一条记录的偏移(最后一个为记录末尾), 然后是各个section的记录.
+// 每条记录为RecordHeader + key + value, 按本机字节序保存. 加载时各个section可以由不同的线程并行解析
+namespace snapshot {
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sections;
+    int64_t createTime; // unix时间
+};
+
+struct RecordHeader {
+    uint64_t cas;
+    int64_t expireTime; // unix时间, 0表示永不过期
+    uint32_t nbytes;
+    uint16_t flags;
+    uint8_t nkey;
+    uint8_t reserved;
+};
+
+const char kMagic[8] = { 'M', 'C', 'S', 'N', 'A', 'P', '\0', '\0' };
+const uint32_t kVersion = 1;
+
+struct Record {
+    muduo::StringPiece key;
+    muduo::StringPiece value;
+    uint16_t flags;
+    time_t expireTime;
+    uint64_t cas;
+};
+
+}
+
+// 先写入path.tmp, commit成功后才改名为path, 写到一半的快照不会覆盖旧的快照
+class SnapshotWriter {
+    public:
+        SnapshotWriter();
+
+        ~SnapshotWriter();
+
+        SnapshotWriter(const SnapshotWriter&) = delete;
+
+        SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+        bool open(const std::string& path, int sections);
+
+        // section按顺序开始, 之后append的记录都属于这个section
+        void beginSection(int section);
+
+        void append(const snapshot::Record& record);
+
+        bool commit();
+
+    private:
+        void write(const void* data, size_t size);
+
+        FILE* file;
+        std::string path;
+        std::string tmpPath;
+        std::vector<uint64_t> offsets;
+        uint64_t offset;
+        std::vector<char> buffer; // FILE的缓冲区
+};
+
+// 用mmap读取快照
+class SnapshotReader {
+    public:
+        SnapshotReader();
+
+        ~SnapshotReader();
+
+        SnapshotReader(const SnapshotReader&) = delete;
+
+        SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+        // 文件不存在或格式不对时返回false
+        bool open(const std::string& path);
+
+        int sections() const { return static_cast<int>(offsets.size()) - 1; }
+
+        time_t createTime() const { return createTime_; }
+
+        // 对section中的每条记录调用func, 记录不完整时返回false
+        template<typename Func>
+        bool forEach(int section, Func func) const {
+            const char* p = data + offsets[section];
+            const char* end = data + offsets[section + 1];
+            while(p < end) {
+                snapshot::RecordHeader header;
+                if(static_cast<size_t>(end - p) < sizeof(header)) {
+                    return false;
+                }
+                ::memcpy(&header, p, sizeof(header));
+                p += sizeof(header);
+                if(static_cast<size_t>(end - p) < header.nkey + static_cast<size_t>(header.nbytes)) {
+                    return false;
+                }
+                snapshot::Record record;
+                record.key = muduo::StringPiece(p, header.nkey);
+                record.value = muduo::StringPiece(p + header.nkey, static_cast<int>(header.nbytes));
+                record.flags = header.flags;
+                record.expireTime = static_cast<time_t>(header.expireTime);
+                record.cas = header.cas;
+                p += header.nkey + static_cast<size_t>(header.nbytes);
+                func(record);
+            }
+
+            return true;
+        }
+
+    private:
+        const char* data;
+        size_t size;
+        time_t createTime_;
+        std::vector<uint64_t> offsets;
+};
+
+#endif
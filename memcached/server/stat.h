@@ -5,132 +5,103 @@
 #include "muduo/base/Timestamp.h"
 
 #include "item.h"
+#include "lru.h"
+#include "slabs.h"
 
+#include <atomic>
 #include <iostream>
 #include <sstream>
 #include <memory>
 #include <map>
-#include <mutex>
 
+// 计数器按线程分片, 每个线程只修改自己的Block, report时再把所有Block加起来.
+// 线程数超过kMaxThreads时多个线程共用一个Block, 所以计数仍然用原子操作
 class MemcachedStat {
     public:
+        // 统计延迟的命令类型
+        enum LatencyType {
+            kLatencyGet, kLatencySet, kLatencyCas, kLatencyIncr, kLatencyDecr,
+            kLatencyDelete, kLatencyTouch, kLatencyOther,
+            kNumLatencyTypes
+        };
+
         MemcachedStat()
             : startTime(static_cast<uint32_t>(muduo::ProcessInfo::startTime().secondsSinceEpoch())),
-        currItems(0), totalItems(0), bytesUsed(0), currConnections(0), totalConnections(0), 
-        cmdGetCount(0), cmdSetCount(0),
-        cmdFlushCount(0), cmdTouchCount(0), getHitCount(0), getMissCount(0), 
-        deleteHitCount(0), deleteMissCount(0), incrHitCount(0), incrMissCount(0),
-        decrHitCount(0), decrMissCount(0), casHitCount(0), casMissCount(0), casBadValCount(0),
-        touchHitCount(0), touchMissCount(0) {
+            maxBytes(0), latencies(new LatencyBlock[kMaxThreads]) {
+            for(auto& block : blocks) {
+                for(auto& counter : block.counters) {
+                    counter.store(0, std::memory_order_relaxed);
+                }
+            }
+            for(size_t i = 0; i < kMaxThreads; ++i) {
+                for(auto& histogram : latencies[i].buckets) {
+                    for(auto& bucket : histogram) {
+                        bucket.store(0, std::memory_order_relaxed);
+                    }
+                }
+            }
         }
 
-        void addCurrItems(int i) { 
-            std::lock_guard<std::mutex> lock(mtx);
-            currItems += i; 
-        }
-        void addTotalItems() { 
-            std::lock_guard<std::mutex> lock(mtx);
-            totalItems++; 
-        }
+        void addCurrItems(int i) { add(kCurrItems, i); }
+        void addTotalItems() { add(kTotalItems, 1); }
 
-        void addCurrConnections(int i) { 
-            std::lock_guard<std::mutex> lock(mtx);
-            currConnections += i; 
-        }
+        void addBytes(int64_t i) { add(kBytesUsed, i); }
 
-        void addTotalConnections() { 
-            std::lock_guard<std::mutex> lock(mtx);
-            totalConnections++; 
-        }
+        void setMaxBytes(uint64_t bytes) { maxBytes = bytes; }
 
-        void addCmdGetCount() { 
-            std::lock_guard<std::mutex> lock(mtx);
-            cmdGetCount++; 
-        }
+        void addEvictions() { add(kEvictions, 1); }
 
-        void addCmdGetHitCount() { 
-            std::lock_guard<std::mutex> lock(mtx);
-            getHitCount++; 
-        }
+        void addReclaimed() { add(kReclaimed, 1); }
 
-        void addCmdGetMissCount() { 
-            std::lock_guard<std::mutex> lock(mtx);
-            getMissCount++; 
-        }
+        void addCrawlerReclaimed() { add(kCrawlerReclaimed, 1); }
 
-        void addCmdSetCount() { 
-            std::lock_guard<std::mutex> lock(mtx);
-            cmdSetCount++; 
-        }
+        void addCurrConnections(int i) { add(kCurrConnections, i); }
 
-        void addCmdFlushCount() { 
-            std::lock_guard<std::mutex> lock(mtx);
-            cmdFlushCount++; 
-        }
+        void addTotalConnections() { add(kTotalConnections, 1); }
 
-        void addCmdTouchCount() { 
-            std::lock_guard<std::mutex> lock(mtx);
-            cmdTouchCount++; 
-        }
+        void addCmdGetCount() { add(kCmdGet, 1); }
 
-        void addCmdTouchHitCount() { 
-            std::lock_guard<std::mutex> lock(mtx);
-            touchHitCount++; 
-        }
+        void addCmdGetHitCount() { add(kGetHits, 1); }
 
-        void addCmdTouchMissCount() { 
-            std::lock_guard<std::mutex> lock(mtx);
-            touchMissCount++; 
-        }
+        void addCmdGetMissCount() { add(kGetMisses, 1); }
 
-        void addCasHitCount() {
-            std::lock_guard<std::mutex> lock(mtx);
-            casHitCount++;
-        }
+        void addCmdSetCount() { add(kCmdSet, 1); }
 
-        void addCasMissCount() {
-            std::lock_guard<std::mutex> lock(mtx);
-            casMissCount++;
-        }
+        void addCmdFlushCount() { add(kCmdFlush, 1); }
 
-        void addCasBadValCount() {
-            std::lock_guard<std::mutex> lock(mtx);
-            casBadValCount++;
-        }
+        void addCmdTouchCount() { add(kCmdTouch, 1); }
 
-        void addDeleteHitCount() {
-            std::lock_guard<std::mutex> lock(mtx);
-            deleteHitCount++;
-        }
+        void addCmdTouchHitCount() { add(kTouchHits, 1); }
 
-        void addDeleteMissCount() {
-            std::lock_guard<std::mutex> lock(mtx);
-            deleteMissCount++;
-        }
+        void addCmdTouchMissCount() { add(kTouchMisses, 1); }
 
-        void addIncrHitCount() {
-            std::lock_guard<std::mutex> lock(mtx);
-            incrHitCount++;
-        }
+        void addCasHitCount() { add(kCasHits, 1); }
 
-        void addIncrMissCount() {
-            std::lock_guard<std::mutex> lock(mtx);
-            incrMissCount++;
-        }
+        void addCasMissCount() { add(kCasMisses, 1); }
 
-        void addDecrHitCount() {
-            std::lock_guard<std::mutex> lock(mtx);
-            decrHitCount++;
-        }
+        void addCasBadValCount() { add(kCasBadVal, 1); }
+
+        void addDeleteHitCount() { add(kDeleteHits, 1); }
+
+        void addDeleteMissCount() { add(kDeleteMisses, 1); }
+
+        void addIncrHitCount() { add(kIncrHits, 1); }
 
-        void addDecrMissCount() {
-            std::lock_guard<std::mutex> lock(mtx);
-            decrMissCount++;
+        void addIncrMissCount() { add(kIncrMisses, 1); }
+
+        void addDecrHitCount() { add(kDecrHits, 1); }
+
+        void addDecrMissCount() { add(kDecrMisses, 1); }
+
+        // count个type类型的命令, 从收到请求到回复写入连接用了micros微秒
+        void addLatency(LatencyType type, int64_t micros, int count) {
+            latencies[localIndex()].buckets[type][latencyBucket(micros)].fetch_add(count, std::memory_order_relaxed);
         }
 
         muduo::string report() const {
             static const std::string prefix = "STAT ";
-            std::lock_guard<std::mutex> lock(mtx);
+            int64_t c[kNumCounters];
+            sum(c);
             std::stringstream fmt;
             fmt << prefix << "pid " << muduo::ProcessInfo::pid() << "\r\n";
             fmt << prefix << "uptime " << muduo::Timestamp::now().secondsSinceEpoch() - startTime << "\r\n";
@@ -138,58 +109,192 @@ class MemcachedStat {
             fmt << prefix << "pointer_size " << sizeof(void*) << "\r\n";
             fmt << prefix << "rusage_user " << muduo::ProcessInfo::cpuTime().userSeconds << "\r\n";
             fmt << prefix << "rusage_system " << muduo::ProcessInfo::cpuTime().systemSeconds << "\r\n";
-            fmt << prefix << "curr_connections " << currConnections << "\r\n";
-            fmt << prefix << "total_connnections " << totalConnections << "\r\n";
-            fmt << prefix << "cmd_get " << cmdGetCount << "\r\n";
-            fmt << prefix << "cmd_set " << cmdSetCount << "\r\n";
-            fmt << prefix << "cmd_flush " << cmdFlushCount << "\r\n";
-            fmt << prefix << "cmd_touch " << cmdTouchCount << "\r\n";
-            fmt << prefix << "get_hits " << getHitCount << "\r\n";
-            fmt << prefix << "get_misses " << getMissCount << "\r\n";
-            fmt << prefix << "delete_hits " << deleteHitCount << "\r\n";
-            fmt << prefix << "delete_misses " << deleteMissCount << "\r\n";
-            fmt << prefix << "incr_hits " << incrHitCount << "\r\n";
-            fmt << prefix << "incr_misses " << incrMissCount << "\r\n";
-            fmt << prefix << "decr_hits " << decrHitCount << "\r\n";
-            fmt << prefix << "decr_misses " <<  decrMissCount << "\r\n";
-            fmt << prefix << "cas_hits " << casHitCount << "\r\n";
-            fmt << prefix << "cas_misses " << casMissCount << "\r\n";
-            fmt << prefix << "cas_badval " << casBadValCount << "\r\n";
-            fmt << prefix << "touch_hits " << touchHitCount << "\r\n";
-            fmt << prefix << "touch_misses " << touchMissCount << "\r\n";
-            fmt << prefix << "bytes " << bytesUsed << "\r\n";
-            fmt << prefix << "curr_items " << currItems << "\r\n";
-            fmt << prefix << "total_items " << totalItems << "\r\n";
+            fmt << prefix << "curr_connections " << c[kCurrConnections] << "\r\n";
+            fmt << prefix << "total_connnections " << c[kTotalConnections] << "\r\n";
+            fmt << prefix << "cmd_get " << c[kCmdGet] << "\r\n";
+            fmt << prefix << "cmd_set " << c[kCmdSet] << "\r\n";
+            fmt << prefix << "cmd_flush " << c[kCmdFlush] << "\r\n";
+            fmt << prefix << "cmd_touch " << c[kCmdTouch] << "\r\n";
+            fmt << prefix << "get_hits " << c[kGetHits] << "\r\n";
+            fmt << prefix << "get_misses " << c[kGetMisses] << "\r\n";
+            fmt << prefix << "delete_hits " << c[kDeleteHits] << "\r\n";
+            fmt << prefix << "delete_misses " << c[kDeleteMisses] << "\r\n";
+            fmt << prefix << "incr_hits " << c[kIncrHits] << "\r\n";
+            fmt << prefix << "incr_misses " << c[kIncrMisses] << "\r\n";
+            fmt << prefix << "decr_hits " << c[kDecrHits] << "\r\n";
+            fmt << prefix << "decr_misses " <<  c[kDecrMisses] << "\r\n";
+            fmt << prefix << "cas_hits " << c[kCasHits] << "\r\n";
+            fmt << prefix << "cas_misses " << c[kCasMisses] << "\r\n";
+            fmt << prefix << "cas_badval " << c[kCasBadVal] << "\r\n";
+            fmt << prefix << "touch_hits " << c[kTouchHits] << "\r\n";
+            fmt << prefix << "touch_misses " << c[kTouchMisses] << "\r\n";
+            fmt << prefix << "bytes " << c[kBytesUsed] << "\r\n";
+            fmt << prefix << "curr_items " << c[kCurrItems] << "\r\n";
+            fmt << prefix << "total_items " << c[kTotalItems] << "\r\n";
+            fmt << prefix << "evictions " << c[kEvictions] << "\r\n";
+            fmt << prefix << "reclaimed " << c[kReclaimed] << "\r\n";
+            fmt << prefix << "crawler_reclaimed " << c[kCrawlerReclaimed] << "\r\n";
+            fmt << prefix << "limit_maxbytes " << maxBytes << "\r\n";
             
             return muduo::string(fmt.str().c_str());
         }
 
+        muduo::string reportSlabs(const SlabAllocator& slabs) const {
+            static const std::string prefix = "STAT ";
+            std::vector<SlabClassStat> classes = slabs.stats();
+            std::stringstream fmt;
+            for(auto& cls : classes) {
+                fmt << prefix << cls.id << ":chunk_size " << cls.chunkSize << "\r\n";
+                fmt << prefix << cls.id << ":chunks_per_page " << cls.chunksPerPage << "\r\n";
+                fmt << prefix << cls.id << ":total_pages " << cls.totalPages << "\r\n";
+                fmt << prefix << cls.id << ":total_chunks " << cls.totalChunks << "\r\n";
+                fmt << prefix << cls.id << ":used_chunks " << cls.usedChunks << "\r\n";
+                fmt << prefix << cls.id << ":free_chunks " << cls.freeChunks << "\r\n";
+            }
+            fmt << prefix << "active_slabs " << classes.size() << "\r\n";
+            fmt << prefix << "total_malloced " << slabs.memMalloced() << "\r\n";
+
+            return muduo::string(fmt.str().c_str());
+        }
+
+        muduo::string reportItems(const Lru& lru) const {
+            static const std::string prefix = "STAT items:";
+            std::stringstream fmt;
+            for(auto& cls : lru.stats()) {
+                fmt << prefix << cls.id << ":number " << cls.number << "\r\n";
+                fmt << prefix << cls.id << ":age " << cls.age << "\r\n";
+                fmt << prefix << cls.id << ":evicted " << cls.evicted << "\r\n";
+                fmt << prefix << cls.id << ":evicted_nonzero " << cls.evictedNonzero << "\r\n";
+                fmt << prefix << cls.id << ":outofmemory " << cls.outOfMemory << "\r\n";
+                fmt << prefix << cls.id << ":reclaimed " << cls.reclaimed << "\r\n";
+            }
+
+            return muduo::string(fmt.str().c_str());
+        }
+
+        // 每种命令的请求数和延迟的分位数(微秒), 分位数为所在bucket的上界
+        muduo::string reportLatency() const {
+            static const std::string prefix = "STAT ";
+            static const char* names[kNumLatencyTypes] = {
+                "get", "set", "cas", "incr", "decr", "delete", "touch", "other"
+            };
+            std::stringstream fmt;
+            for(int type = 0; type < kNumLatencyTypes; ++type) {
+                uint64_t histogram[kLatencyBuckets] = { 0 };
+                uint64_t count = 0;
+                for(size_t i = 0; i < kMaxThreads; ++i) {
+                    for(int b = 0; b < kLatencyBuckets; ++b) {
+                        uint64_t n = latencies[i].buckets[type][b].load(std::memory_order_relaxed);
+                        histogram[b] += n;
+                        count += n;
+                    }
+                }
+                fmt << prefix << names[type] << ":count " << count << "\r\n";
+                fmt << prefix << names[type] << ":p50_us " << percentile(histogram, count, 0.5) << "\r\n";
+                fmt << prefix << names[type] << ":p99_us " << percentile(histogram, count, 0.99) << "\r\n";
+                fmt << prefix << names[type] << ":p999_us " << percentile(histogram, count, 0.999) << "\r\n";
+                fmt << prefix << names[type] << ":max_us " << percentile(histogram, count, 1.0) << "\r\n";
+            }
+
+            return muduo::string(fmt.str().c_str());
+        }
+
     private:
-        uint32_t startTime;
-        uint32_t currItems;
-        uint32_t totalItems;
-        uint64_t bytesUsed;
-        uint32_t currConnections;
-        uint32_t totalConnections;
-        uint64_t cmdGetCount;
-        uint64_t cmdSetCount;
-        uint64_t cmdFlushCount;
-        uint64_t cmdTouchCount;
-        uint64_t getHitCount;
-        uint64_t getMissCount;
-        uint64_t deleteHitCount;
-        uint64_t deleteMissCount;
-        uint64_t incrHitCount;
-        uint64_t incrMissCount;
-        uint64_t decrHitCount;
-        uint64_t decrMissCount;
-        uint64_t casHitCount;
-        uint64_t casMissCount;
-        uint64_t casBadValCount;
-        uint64_t touchHitCount;
-        uint64_t touchMissCount;
-
-        mutable std::mutex mtx;
+        enum Counter {
+            kCurrItems, kTotalItems, kBytesUsed, kCurrConnections, kTotalConnections,
+            kCmdGet, kCmdSet, kCmdFlush, kCmdTouch, kGetHits, kGetMisses,
+            kDeleteHits, kDeleteMisses, kIncrHits, kIncrMisses, kDecrHits, kDecrMisses,
+            kCasHits, kCasMisses, kCasBadVal, kTouchHits, kTouchMisses, kEvictions, kReclaimed,
+            kCrawlerReclaimed,
+            kNumCounters
+        };
+
+        const static size_t kMaxThreads = 64;
+        const static size_t kCacheLineSize = 64;
+
+        // 每个Block按cache line对齐, 不同线程的计数不会互相失效
+        struct alignas(kCacheLineSize) Block {
+            std::atomic<int64_t> counters[kNumCounters];
+        };
+
+        // 延迟直方图(类似HDR Histogram): 小于8微秒时每个值一个bucket, 之后每个2的幂区间分成8个bucket,
+        // 相对误差不超过12.5%. 超过2^32微秒的延迟都计入最后一个bucket
+        const static int kSubBucketBits = 3;
+        const static int kSubBuckets = 1 << kSubBucketBits;
+        const static int kMaxExponent = 31;
+        const static int kLatencyBuckets = (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+
+        // 在堆上分配, C++11的new不保证cache line对齐, 但每个Block有几百个cache line, 相邻Block最多共用一个
+        struct LatencyBlock {
+            std::atomic<uint64_t> buckets[kNumLatencyTypes][kLatencyBuckets];
+        };
+
+        static int latencyBucket(int64_t micros) {
+            uint64_t v = micros > 0 ? static_cast<uint64_t>(micros) : 0;
+            if(v < kSubBuckets) {
+                return static_cast<int>(v);
+            }
+            int exponent = 63 - __builtin_clzll(v);
+            if(exponent > kMaxExponent) {
+                return kLatencyBuckets - 1;
+            }
+            return (exponent - kSubBucketBits + 1) * kSubBuckets
+                + static_cast<int>((v >> (exponent - kSubBucketBits)) & (kSubBuckets - 1));
+        }
+
+        // bucket中最大的值
+        static uint64_t bucketUpperBound(int bucket) {
+            if(bucket < kSubBuckets) {
+                return static_cast<uint64_t>(bucket);
+            }
+            int shift = bucket / kSubBuckets - 1;
+            uint64_t lower = static_cast<uint64_t>(kSubBuckets + bucket % kSubBuckets) << shift;
+            return lower + (static_cast<uint64_t>(1) << shift) - 1;
+        }
+
+        static uint64_t percentile(const uint64_t* histogram, uint64_t count, double q) {
+            if(count == 0) {
+                return 0;
+            }
+            uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count) + 0.5);
+            rank = rank == 0 ? 1 : rank;
+            uint64_t seen = 0;
+            for(int b = 0; b < kLatencyBuckets; ++b) {
+                seen += histogram[b];
+                if(seen >= rank) {
+                    return bucketUpperBound(b);
+                }
+            }
+            return bucketUpperBound(kLatencyBuckets - 1);
+        }
+
+        // 线程第一次修改计数时分配一个Block
+        static size_t localIndex() {
+            static std::atomic<size_t> nextBlock(0);
+            static thread_local size_t index = nextBlock++ % kMaxThreads;
+            return index;
+        }
+
+        // 同一个Block通常只有一个线程修改, relaxed的原子加不会有竞争
+        void add(Counter counter, int64_t n) {
+            blocks[localIndex()].counters[counter].fetch_add(n, std::memory_order_relaxed);
+        }
+
+        void sum(int64_t* result) const {
+            for(int i = 0; i < kNumCounters; ++i) {
+                result[i] = 0;
+            }
+            for(auto& block : blocks) {
+                for(int i = 0; i < kNumCounters; ++i) {
+                    result[i] += block.counters[i].load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        const uint32_t startTime;
+        std::atomic<uint64_t> maxBytes;
+        Block blocks[kMaxThreads];
+        std::unique_ptr<LatencyBlock[]> latencies; // 比计数器大得多, 放在堆上
 };
 
 #endif
@@ -0,0 +1,50 @@
+#ifndef MEMCACHED_UTIL_H
+#define MEMCACHED_UTIL_H
+
+#include "muduo/base/StringPiece.h"
+
+#include <stdint.h>
+
+#include <limits>
+
+// 十进制字符串转换为无符号整数. 只接受数字, 超出T的范围时返回false
+template<typename T>
+bool toUint(const muduo::StringPiece& str, T* value) {
+    if(str.empty()) {
+        return false;
+    }
+    const uint64_t max = std::numeric_limits<T>::max();
+    uint64_t result = 0;
+    for(int i = 0; i < str.size(); ++i) {
+        if(str[i] < '0' || str[i] > '9') {
+            return false;
+        }
+        uint64_t digit = static_cast<uint64_t>(str[i] - '0');
+        if(result > (max - digit) / 10) {
+            return false;
+        }
+        result = result * 10 + digit;
+    }
+    *value = static_cast<T>(result);
+
+    return true;
+}
+
+const size_t kMaxUint64Length = 20;
+
+// 把value的十进制表示写入buf(至少kMaxUint64Length字节), 返回长度
+inline size_t formatUint(uint64_t value, char* buf) {
+    char tmp[kMaxUint64Length];
+    size_t len = 0;
+    do {
+        tmp[len++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while(value != 0);
+    for(size_t i = 0; i < len; ++i) {
+        buf[i] = tmp[len - 1 - i];
+    }
+
+    return len;
+}
+
+#endif
@@ -0,0 +1,139 @@
+// ItemTable的并发压力测试: 写线程持有锁反复插入, 替换和删除少量key,
+// 删除标记很多, 会反复重建同样大小的表; 读线程同时无锁查找并检查value.
+// 在server目录下 make ItemTableTest 编译, 失败时返回非0
+#include "item.h"
+#include "itemTable.h"
+#include "keyHash.h"
+#include "slabs.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kKeys = 5000;
+const int kWriters = 3;
+const int kReaders = 4;
+const int kWritesPerThread = 1000000;
+
+std::string keyOf(int k) {
+    return "key" + std::to_string(k);
+}
+
+std::string valueOf(const std::string& key) {
+    return key + "-v";
+}
+
+}
+
+int main() {
+    SlabAllocator slabs(256 << 20);
+    ItemTable table;
+    table.init(4);
+    std::mutex mutex;
+    std::atomic<uint64_t> casUnique(0);
+    std::atomic<bool> stop(false);
+    std::atomic<long> hits(0);
+    std::atomic<long> bad(0);
+
+    auto writer = [&](int id) {
+        for(int n = 0; n < kWritesPerThread; ++n) {
+            std::string key = keyOf(static_cast<int>((static_cast<long>(n) * 7919 + id * 13) % kKeys));
+            std::string value = valueOf(key);
+            uint64_t hash = hashKey(key);
+            unsigned int clsid = slabs.classId(Item::totalSize(key.size(), value.size()));
+            Item* item = Item::create(&slabs, clsid, key, hash, value.size(), 0, 0, ++casUnique);
+            ::memcpy(item->valueData(), value.data(), value.size());
+
+            std::lock_guard<std::mutex> lock(mutex);
+            Item* old = table.find(key, hash);
+            if(n % 3 == 0) {
+                if(old != nullptr) {
+                    table.remove(old);
+                    old->decrRef();
+                }
+                item->decrRef();
+            }
+            else if(old != nullptr) {
+                table.replace(old, item);
+                old->decrRef();
+            }
+            else {
+                table.insert(item);
+            }
+        }
+    };
+
+    auto reader = [&]() {
+        while(!stop) {
+            for(int k = 0; k < kKeys; ++k) {
+                std::string key = keyOf(k);
+                uint64_t hash = hashKey(key);
+                Item* item = nullptr;
+                if(!table.tryAcquire(key, hash, &item)) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    item = table.find(key, hash);
+                    if(item != nullptr) {
+                        item->incrRef();
+                    }
+                }
+                if(item != nullptr) {
+                    ++hits;
+                    if(item->key().as_string() != key || item->value().as_string() != valueOf(key)) {
+                        ++bad;
+                    }
+                    item->decrRef();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> readers;
+    for(int i = 0; i < kReaders; ++i) {
+        readers.emplace_back(reader);
+    }
+    std::vector<std::thread> writers;
+    for(int i = 0; i < kWriters; ++i) {
+        writers.emplace_back(writer, i);
+    }
+    for(auto& t : writers) {
+        t.join();
+    }
+    stop = true;
+    for(auto& t : readers) {
+        t.join();
+    }
+
+    // 表中的item都能找到, 且每个key只出现一次
+    int items = 0;
+    int missing = 0;
+    std::set<std::string> keys;
+    table.forEach([&](Item* item) {
+        ++items;
+        keys.insert(item->key().as_string());
+        if(table.find(item->key(), item->hash()) != item) {
+            ++missing;
+        }
+    });
+    int present = 0;
+    for(int k = 0; k < kKeys; ++k) {
+        std::string key = keyOf(k);
+        if(table.find(key, hashKey(key)) != nullptr) {
+            ++present;
+        }
+    }
+
+    printf("hits %ld bad %ld items %d keys %zu present %d missing %d\n",
+            hits.load(), bad.load(), items, keys.size(), present, missing);
+    bool ok = bad == 0 && missing == 0 && items == present && static_cast<size_t>(items) == keys.size();
+    printf("%s\n", ok ? "PASS" : "FAIL");
+
+    return ok ? 0 : 1;
+}
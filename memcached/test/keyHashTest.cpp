@@ -0,0 +1,130 @@
+// hashKey()的分布质量测试和速度测试.
+// 对几类典型的key检查shard(高12位), 组(低12位)和tag(中间7位)的卡方值, 以及输入每一位的雪崩效果.
+// 在server目录下 make KeyHashTest 编译, 失败时返回非0
+#include "keyHash.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int kKeys = 1 << 20;
+
+struct Field {
+    const char* name;
+    int shift;
+    int bits;
+};
+
+// 和memcached.h, itemTable.h中的用法一致
+const Field kFields[] = {
+    { "shard", 64 - 12, 12 },
+    { "group", 0, 12 },
+    { "tag", 44, 7 },
+};
+
+// 期望值为df, 标准差为sqrt(2 * df), 偏离超过6个标准差认为分布不均匀
+bool checkDistribution(const char* pattern, const std::vector<uint64_t>& hashes) {
+    bool ok = true;
+    for(const Field& field : kFields) {
+        size_t buckets = static_cast<size_t>(1) << field.bits;
+        std::vector<size_t> counts(buckets, 0);
+        for(uint64_t h : hashes) {
+            ++counts[(h >> field.shift) & (buckets - 1)];
+        }
+        double expected = static_cast<double>(hashes.size()) / buckets;
+        double chi2 = 0;
+        for(size_t c : counts) {
+            chi2 += (c - expected) * (c - expected) / expected;
+        }
+        double df = static_cast<double>(buckets - 1);
+        double sigma = (chi2 - df) / sqrt(2 * df);
+        bool good = fabs(sigma) < 6;
+        printf("%-12s %-6s chi2 %10.1f df %5.0f sigma %6.2f %s\n", pattern, field.name, chi2, df, sigma,
+                good ? "" : "BAD");
+        ok = ok && good;
+    }
+
+    return ok;
+}
+
+// 翻转输入的任意一位, 输出的每一位都应该以接近1/2的概率翻转
+bool checkAvalanche(const char* pattern, const std::function<std::string(int)>& keyOf) {
+    const int kSamples = 4000;
+    double worst = 0;
+    size_t len = keyOf(0).size();
+    for(size_t bit = 0; bit < len * 8; ++bit) {
+        std::vector<int> flips(64, 0);
+        for(int n = 0; n < kSamples; ++n) {
+            std::string key = keyOf(n);
+            uint64_t h = hashKey(key);
+            key[bit / 8] ^= static_cast<char>(1 << (bit % 8));
+            uint64_t diff = h ^ hashKey(key);
+            for(int i = 0; i < 64; ++i) {
+                flips[i] += (diff >> i) & 1;
+            }
+        }
+        for(int i = 0; i < 64; ++i) {
+            double bias = fabs(static_cast<double>(flips[i]) / kSamples - 0.5);
+            worst = bias > worst ? bias : worst;
+        }
+    }
+    bool good = worst < 0.06;
+    printf("%-12s avalanche worst bias %.4f %s\n", pattern, worst, good ? "" : "BAD");
+
+    return good;
+}
+
+void benchmark(const char* pattern, const std::vector<std::string>& keys) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t sum = 0;
+    const int kRounds = 10;
+    for(int r = 0; r < kRounds; ++r) {
+        for(auto& key : keys) {
+            sum += hashKey(key);
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("%-12s %6.2f ns/key (%llx)\n", pattern, ns / (keys.size() * kRounds), static_cast<unsigned long long>(sum));
+}
+
+}
+
+int main() {
+    struct Pattern {
+        const char* name;
+        std::function<std::string(int)> keyOf;
+    };
+    const std::string prefix(40, 'p');
+    // 常见的key: 顺序编号, 很短的二进制key, 只有几个字节不同的长key
+    Pattern patterns[] = {
+        { "sequential", [](int n) { return "key:" + std::to_string(n); } },
+        { "short", [](int n) { return std::string(reinterpret_cast<const char*>(&n), 3); } },
+        { "medium", [](int n) { return "user:" + std::to_string(n) + ":session"; } },
+        { "long", [&prefix](int n) { return prefix + std::to_string(n) + prefix; } },
+    };
+
+    bool ok = true;
+    for(const Pattern& pattern : patterns) {
+        std::vector<std::string> keys;
+        std::vector<uint64_t> hashes;
+        keys.reserve(kKeys);
+        hashes.reserve(kKeys);
+        // short只取n的低3字节, kKeys小于1 << 24时key互不相同
+        for(int n = 0; n < kKeys; ++n) {
+            keys.push_back(pattern.keyOf(n));
+            hashes.push_back(hashKey(keys.back()));
+        }
+        ok = checkDistribution(pattern.name, hashes) && ok;
+        ok = checkAvalanche(pattern.name, pattern.keyOf) && ok;
+        benchmark(pattern.name, keys);
+    }
+    printf("%s\n", ok ? "PASS" : "FAIL");
+
+    return ok ? 0 : 1;
+}